@@ -1,6 +1,6 @@
 # cython: language_level=3
 
-from libc.stdint cimport uint8_t, uint32_t, uint16_t, int32_t
+from libc.stdint cimport uint8_t, uint32_t, uint16_t, int16_t, int32_t, uint64_t
 
 cdef extern from "fast-slic-common.h":
     ctypedef struct Cluster:
@@ -19,19 +19,52 @@ cdef extern from "fast-slic-common.h":
         int *num_neighbors;
         uint32_t **neighbors;
 
+    ctypedef struct SlicOptions:
+        uint8_t* prev_image
+        float incremental_threshold
+        int pyramid_levels
+        int band_start_iter
+        int band_width
+        int bound_start_iter
+        int subsample_iters
+        int extent_margin
+        const char* algorithm
+        const uint16_t* cluster_S
+        const float* depth
+        float depth_weight
+        uint64_t* num_saturated
+        float time_budget_ms
+        float* finish_ns_per_pixel
+        int* num_iterations
+
+    enum:
+        FAST_SLIC_ASSOC_SPLIT
+        FAST_SLIC_ASSOC_MERGE
+
 
 cdef extern from "fast-slic.h":
     void fast_slic_initialize_clusters(int H, int W, int K, const uint8_t* image, Cluster *clusters) nogil
+    void fast_slic_initialize_clusters_adaptive(int H, int W, int K, const uint8_t* image, const float* density, Cluster *clusters, uint16_t* cluster_S) nogil
+    uint8_t fast_slic_auto_quantize_level(int H, int W, float compactness, const uint8_t* image) nogil
+    void fast_slic_initialize_clusters_3d(int D, int H, int W, int K, const uint8_t* image, Cluster *clusters, uint16_t* cluster_z) nogil
     void fast_slic_iterate(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment) nogil
+    void fast_slic_iterate_ex(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment, const SlicOptions* options) nogil
     Connectivity* fast_slic_get_connectivity(int H, int W, int K, const uint32_t *assignment) nogil
     Connectivity* fast_slic_knn_connectivity(int H, int W, int K, const Cluster* clusters, int num_neighbors) nogil
     void fast_slic_free_connectivity(Connectivity* conn) nogil
+    void fast_slic_associate_clusters(int H, int W, int K_prev, const Cluster* prev_clusters, int K, const Cluster* clusters, float color_weight, int32_t* correspondence, uint8_t* flags) nogil
+    int fast_slic_build_hierarchy(int H, int W, int K, const uint8_t* image, const uint32_t* assignment, int32_t* merges, float* distances) nogil
+    void fast_slic_cut_hierarchy(int K, int num_merges, const int32_t* merges, int num_regions, uint32_t* labels) nogil
+    void fast_slic_estimate_motion(int H, int W, int K, const uint8_t* prev_image, const uint8_t* image, const uint32_t* prev_assignment, int search_radius, int16_t* motion) nogil
     void fast_slic_get_mask_density(int H, int W, int K, const Cluster* clusters, const uint32_t* assignment, const uint8_t *mask, uint8_t *cluster_densities) nogil
     void fast_slic_cluster_density_to_mask(int H, int W, int K, const Cluster *clusters, const uint32_t* assignment, const uint8_t *cluster_densities, uint8_t *result) nogil
 
 cdef extern from "fast-slic-avx2.h":
     void fast_slic_initialize_clusters_avx2(int H, int W, int K, const uint8_t* image, Cluster *clusters) nogil
     void fast_slic_iterate_avx2(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment) nogil
+    void fast_slic_iterate_avx2_ex(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment, const SlicOptions* options) nogil
+    void fast_slic_iterate_avx2_3d(int D, int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint16_t* cluster_z, uint32_t* assignment) nogil
+    void fast_slic_estimate_motion_avx2(int H, int W, int K, const uint8_t* prev_image, const uint8_t* image, const uint32_t* prev_assignment, int search_radius, int16_t* motion) nogil
     int fast_slic_supports_avx2() nogil
 
 
@@ -47,9 +80,16 @@ cdef class BaseSlicModel:
     cdef Cluster* _c_clusters
     cdef readonly int num_components
     cdef public object initialized
+    cdef public object cluster_S
+    cdef public object cluster_z
+    cdef public object num_saturated
+    cdef public object num_iterations
+    cdef float _finish_ns_per_pixel
 
     cpdef void initialize(self, const uint8_t [:, :, ::1] image)
-    cpdef iterate(self, const uint8_t [:, :, ::1] image, int max_iter, float compactness, float min_size_factor, uint8_t quantize_level)
+    cpdef void initialize_adaptive(self, const uint8_t [:, :, ::1] image, density=*)
+    cpdef void initialize_volume(self, const uint8_t [:, :, :, ::1] volume)
+    cpdef iterate(self, const uint8_t [:, :, ::1] image, int max_iter, float compactness, float min_size_factor, uint8_t quantize_level, dict options=*)
     cpdef get_connectivity(self, const int32_t[:,::1] assignments)
     cpdef get_knn_connectivity(self, const int32_t[:,::1] assignments, size_t num_neighbors)
     cpdef get_mask_density(self, const uint8_t[:, ::1] mask, const int32_t[:, ::1] assignments)
@@ -5,7 +5,7 @@ cimport numpy as np
 
 import numpy as np
 
-from libc.stdint cimport uint8_t, int32_t, uint32_t, uint16_t
+from libc.stdint cimport uint8_t, int16_t, int32_t, uint32_t, uint16_t, uint64_t, UINT64_MAX
 from libc.stdlib cimport malloc, free
 from libc.string cimport memcpy, memset
 
@@ -21,11 +21,24 @@ cdef class BaseSlicModel:
         self._c_clusters = <cfast_slic.Cluster *>malloc(sizeof(cfast_slic.Cluster) * num_components)
         memset(self._c_clusters, 0, sizeof(cfast_slic.Cluster) * num_components)
         self.initialized = False
+        # Half window size of each cluster (uint16 [K]) after initialize_adaptive, None for the regular grid
+        self.cluster_S = None
+        # Slice of each cluster (uint16 [K]) after initialize_volume, None for images
+        self.cluster_z = None
+        # Saturated distances of the last iterate with count_saturation, None if not counted
+        self.num_saturated = None
+        # Iterations run by the last iterate, None before the first one
+        self.num_iterations = None
+        # Connectivity enforcement cost measured by the last iterate, for the time budget of the next one
+        self._finish_ns_per_pixel = 0
 
     def copy(self):
         result = SlicModel(self.num_components)
         memcpy(result._c_clusters, self._c_clusters, sizeof(cfast_slic.Cluster) * self.num_components)
         result.initialized = self.initialized
+        result.cluster_S = None if self.cluster_S is None else self.cluster_S.copy()
+        result.cluster_z = None if self.cluster_z is None else self.cluster_z.copy()
+        result._finish_ns_per_pixel = self._finish_ns_per_pixel
         return result
 
 
@@ -76,6 +89,8 @@ cdef class BaseSlicModel:
             free(self._c_clusters)
         self._c_clusters = new_clusters
         self.num_components = num_new_clusters
+        self.cluster_S = None
+        self.cluster_z = None
         self.initialized = True
 
     def to_yxmrgb(self):
@@ -119,22 +134,75 @@ cdef class BaseSlicModel:
                 raise RuntimeError("Not reachable")
         else:
             raise ValueError("image cannot be empty")
+        self.cluster_S = None
+        self.cluster_z = None
         self.initialized = True
 
+    cpdef void initialize_adaptive(self, const uint8_t [:, :, ::1] image, density=None):
+        """Places the seeds by local detail and gives each cluster its own window size.
 
-    cpdef iterate(self, const uint8_t [:, :, ::1] image, int max_iter, float compactness, float min_size_factor, uint8_t quantize_level): 
-        if not self.initialized:
-            raise RuntimeError("Slic model is not initialized")
+        density (optional float [H, W]): where to put more superpixels. Defaults to the gradient energy of the image.
+        """
         if image.shape[2] != 3:
             raise ValueError("nchan != 3")
+
         cdef int H = image.shape[0]
         cdef int W = image.shape[1]
         cdef int K = self.num_components
-        cdef np.ndarray[np.uint32_t, ndim=2, mode='c'] assignments = np.zeros([H, W], dtype=np.uint32)
-        cdef cfast_slic.Cluster* c_clusters = self._c_clusters
+        cdef const float [:, ::1] density_view
+        cdef const float* c_density = NULL
+        cdef np.ndarray[np.uint16_t, ndim=1, mode='c'] cluster_S = np.zeros([K], dtype=np.uint16)
 
-        if self._get_name() == 'standard':
-            cfast_slic.fast_slic_iterate(
+        if H <= 0 or W <= 0:
+            raise ValueError("image cannot be empty")
+        if density is not None:
+            density_view = np.ascontiguousarray(density, dtype=np.float32)
+            if density_view.shape[0] != H or density_view.shape[1] != W:
+                raise ValueError("The shape of density does not match the one of image")
+            c_density = &density_view[0, 0]
+        cfast_slic.fast_slic_initialize_clusters_adaptive(H, W, K, &image[0, 0, 0], c_density, self._c_clusters, &cluster_S[0])
+        self.cluster_S = cluster_S
+        self.cluster_z = None
+        self.initialized = True
+
+    cpdef void initialize_volume(self, const uint8_t [:, :, :, ::1] volume):
+        """Seeds the clusters on a 3-D lattice over volume (uint8 [D, H, W, 3]) for iterate_volume."""
+        if volume.shape[3] != 3:
+            raise ValueError("nchan != 3")
+
+        cdef int D = volume.shape[0]
+        cdef int H = volume.shape[1]
+        cdef int W = volume.shape[2]
+        cdef int K = self.num_components
+        cdef np.ndarray[np.uint16_t, ndim=1, mode='c'] cluster_z = np.zeros([K], dtype=np.uint16)
+
+        if D <= 0 or H <= 0 or W <= 0:
+            raise ValueError("volume cannot be empty")
+        cfast_slic.fast_slic_initialize_clusters_3d(D, H, W, K, &volume[0, 0, 0, 0], self._c_clusters, &cluster_z[0])
+        self.cluster_S = None
+        self.cluster_z = cluster_z
+        self.initialized = True
+
+    def iterate_volume(self, const uint8_t [:, :, :, ::1] volume, int max_iter, float compactness, float min_size_factor, uint8_t quantize_level):
+        """Runs SLIC iterations over volume (uint8 [D, H, W, 3]) after initialize_volume (avx2 only).
+
+        Returns the supervoxel labels (int32 [D, H, W]).
+        """
+        if self.cluster_z is None:
+            raise RuntimeError("Slic model is not initialized for volumes")
+        if volume.shape[3] != 3:
+            raise ValueError("nchan != 3")
+        if self._get_name() != 'avx2':
+            raise NotImplementedError("Supervoxels require the avx2 backend")
+        cdef int D = volume.shape[0]
+        cdef int H = volume.shape[1]
+        cdef int W = volume.shape[2]
+        cdef int K = self.num_components
+        cdef np.ndarray[np.uint16_t, ndim=1, mode='c'] cluster_z = self.cluster_z
+        cdef np.ndarray[np.uint32_t, ndim=3, mode='c'] assignments = np.zeros([D, H, W], dtype=np.uint32)
+        with nogil:
+            cfast_slic.fast_slic_iterate_avx2_3d(
+                D,
                 H,
                 W,
                 K,
@@ -142,25 +210,133 @@ cdef class BaseSlicModel:
                 min_size_factor,
                 quantize_level,
                 max_iter,
-                &image[0, 0, 0],
-                c_clusters,
-                <uint32_t *>&assignments[0, 0]
+                &volume[0, 0, 0, 0],
+                self._c_clusters,
+                &cluster_z[0],
+                <uint32_t *>&assignments[0, 0, 0],
             )
+        result = assignments.astype(np.int32)
+        result[result == 0xFFFF] = -1
+        return result
+
+
+    cpdef iterate(self, const uint8_t [:, :, ::1] image, int max_iter, float compactness, float min_size_factor, uint8_t quantize_level, dict options=None):
+        """Runs SLIC iterations.
+
+        options (optional dict):
+            prev_image: reference frame (uint8 [H, W, 3]) for the incremental mode, the frame the labels of each tile were
+                last computed on. Its changed tiles are updated in place to image. Requires prev_assignment.
+            prev_assignment: labels of the previous frame (int32 [H, W]).
+            incremental_threshold: mean absolute difference per channel above which a 16x16 tile counts as changed.
+            pyramid_levels: number of 2x downsamplings (0-2) for the coarse-to-fine mode (avx2 only).
+            band_start_iter: iteration from which only the pixels near label changes are re-evaluated (avx2 only, 0 to disable).
+            band_width: distance in pixels to a label boundary or change within which pixels are re-evaluated (default 2, at most 8).
+            bound_start_iter: iteration from which rows whose distance bounds still hold are not re-evaluated (avx2 only, 0 to disable).
+            subsample_iters: number of leading iterations that only assign every other pixel row (avx2 only, 0 to disable).
+            algorithm: assignment kernel, 'cluster_oriented' (default) or 'tiled' (64x16 pixel tiles), avx2 only;
+                'snic' (both backends) grows connected superpixels in one pass instead of iterating,
+                'seeds' (avx2 only) refines a regular grid by color histograms.
+            depth: depth map aligned with image (uint16 or float [H, W]) whose difference joins the color distance (avx2 only).
+            depth_weight: color units per depth unit (default 1); the scaled depth is clamped to [0, 255].
+            count_saturation: counts the candidate distances clamped to 65535 into num_saturated (avx2 cluster-oriented kernel
+                without band or bounds iterations only; None otherwise).
+            time_budget_ms: time budget of the call; iterations stop early so that it ends, connectivity included, within it (0 for none).
+                num_iterations tells how many ran.
+            extent_margin: from the third iteration on, clips each search window to the cluster's member box grown by this many
+                pixels (avx2 cluster-oriented kernel only, 0 to disable).
+        """
+        if not self.initialized:
+            raise RuntimeError("Slic model is not initialized")
+        if image.shape[2] != 3:
+            raise ValueError("nchan != 3")
+        cdef int H = image.shape[0]
+        cdef int W = image.shape[1]
+        cdef int K = self.num_components
+        cdef np.ndarray[np.uint32_t, ndim=2, mode='c'] assignments = np.zeros([H, W], dtype=np.uint32)
+        cdef cfast_slic.Cluster* c_clusters = self._c_clusters
+        cdef cfast_slic.SlicOptions c_options
+        cdef uint8_t [:, :, ::1] prev_image
+        cdef bytes algorithm
+        cdef np.ndarray[np.uint16_t, ndim=1, mode='c'] cluster_S
+        cdef const float [:, ::1] depth
+        # Left as is by the kernels that cannot count
+        cdef uint64_t num_saturated = UINT64_MAX
+        cdef int num_iterations = 0
+
+        memset(&c_options, 0, sizeof(c_options))
+        c_options.num_iterations = &num_iterations
+        c_options.finish_ns_per_pixel = &self._finish_ns_per_pixel
+        if options:
+            if options.get('prev_image') is not None:
+                prev_image = options['prev_image']
+                if prev_image.shape[0] != H or prev_image.shape[1] != W or prev_image.shape[2] != 3:
+                    raise ValueError("The shape of prev_image does not match the one of image")
+                if options.get('prev_assignment') is None:
+                    raise ValueError("prev_image requires prev_assignment")
+                assignments[:, :] = np.asarray(options['prev_assignment']).astype(np.uint32)
+                c_options.prev_image = &prev_image[0, 0, 0]
+            c_options.incremental_threshold = options.get('incremental_threshold', 0)
+            c_options.pyramid_levels = options.get('pyramid_levels', 0)
+            c_options.band_start_iter = options.get('band_start_iter', 0)
+            c_options.band_width = options.get('band_width', 0)
+            c_options.bound_start_iter = options.get('bound_start_iter', 0)
+            c_options.subsample_iters = options.get('subsample_iters', 0)
+            c_options.extent_margin = options.get('extent_margin', 0)
+            if options.get('algorithm') is not None:
+                algorithm = options['algorithm'].encode()
+                c_options.algorithm = algorithm
+            if options.get('depth') is not None:
+                if self._get_name() != 'avx2':
+                    raise NotImplementedError("Depth requires the avx2 backend")
+                depth = np.ascontiguousarray(options['depth'], dtype=np.float32)
+                if depth.shape[0] != H or depth.shape[1] != W:
+                    raise ValueError("The shape of depth does not match the one of image")
+                c_options.depth = &depth[0, 0]
+                c_options.depth_weight = options.get('depth_weight', 1.0)
+            if options.get('count_saturation'):
+                c_options.num_saturated = &num_saturated
+            c_options.time_budget_ms = options.get('time_budget_ms', 0)
+        if self.cluster_S is not None:
+            cluster_S = self.cluster_S
+            c_options.cluster_S = &cluster_S[0]
+        check_options(c_options.prev_image != NULL, self.cluster_S is not None, c_options.depth != NULL,
+                      c_options.pyramid_levels, c_options.band_start_iter, c_options.bound_start_iter, c_options.subsample_iters,
+                      options.get('algorithm') if options else None, c_options.extent_margin)
+
+        if self._get_name() == 'standard':
+            with nogil:
+                cfast_slic.fast_slic_iterate_ex(
+                    H,
+                    W,
+                    K,
+                    compactness,
+                    min_size_factor,
+                    quantize_level,
+                    max_iter,
+                    &image[0, 0, 0],
+                    c_clusters,
+                    <uint32_t *>&assignments[0, 0],
+                    &c_options
+                )
         elif self._get_name() == 'avx2':
-            cfast_slic.fast_slic_iterate_avx2(
-                H,
-                W,
-                K,
-                compactness,
-                min_size_factor,
-                quantize_level,
-                max_iter,
-                &image[0, 0, 0],
-                c_clusters,
-                <uint32_t *>&assignments[0, 0]
-            )
+            with nogil:
+                cfast_slic.fast_slic_iterate_avx2_ex(
+                    H,
+                    W,
+                    K,
+                    compactness,
+                    min_size_factor,
+                    quantize_level,
+                    max_iter,
+                    &image[0, 0, 0],
+                    c_clusters,
+                    <uint32_t *>&assignments[0, 0],
+                    &c_options
+                )
         else:
             raise RuntimeError("Not reachable")
+        self.num_saturated = num_saturated if c_options.num_saturated is not NULL and num_saturated != UINT64_MAX else None
+        self.num_iterations = num_iterations
         result = assignments.astype(np.int32)
         result[result == 0xFFFF] = -1
         return result
@@ -229,7 +405,106 @@ cdef class BaseSlicModel:
 
         return mask
 
-        
+    def associate_clusters(self, BaseSlicModel prev_model, int H, int W, float color_weight=1.0):
+        """Matches each cluster to the nearest cluster of prev_model by (y, x, color).
+
+        Returns (correspondence, flags): correspondence holds the previous cluster number of
+        each cluster (-1 if none), flags holds ASSOC_SPLIT/ASSOC_MERGE bits.
+        """
+        cdef int K = self.num_components
+        cdef int K_prev = prev_model.num_components
+        cdef np.ndarray[np.int32_t, ndim=1, mode='c'] correspondence = np.full([K], -1, dtype=np.int32)
+        cdef np.ndarray[np.uint8_t, ndim=1, mode='c'] flags = np.zeros([K], dtype=np.uint8)
+        with nogil:
+            cfast_slic.fast_slic_associate_clusters(
+                H,
+                W,
+                K_prev,
+                prev_model._c_clusters,
+                K,
+                self._c_clusters,
+                color_weight,
+                <int32_t *>&correspondence[0],
+                <uint8_t *>&flags[0],
+            )
+        return correspondence, flags
+
+    def build_hierarchy(self, const uint8_t [:, :, ::1] image, const int32_t[:, ::1] assignments):
+        """Merges adjacent superpixels by increasing Ward distance of their mean colors until one region is left.
+
+        Returns (merges, distances), a dendrogram in the layout of a scipy linkage matrix: merge i joins the nodes
+        merges[i] (int32 [M, 2]) into node K + i at distances[i] (float32 [M]), nodes below K being the superpixels.
+        """
+        cdef int H = assignments.shape[0]
+        cdef int W = assignments.shape[1]
+        cdef int K = self.num_components
+        cdef int num_merges
+        if image.shape[0] != H or image.shape[1] != W or image.shape[2] != 3:
+            raise ValueError("The shape of image does not match the one of assignments")
+        cdef np.ndarray[np.int32_t, ndim=2, mode='c'] merges = np.zeros([max(K - 1, 1), 2], dtype=np.int32)
+        cdef np.ndarray[np.float32_t, ndim=1, mode='c'] distances = np.zeros([max(K - 1, 1)], dtype=np.float32)
+        with nogil:
+            num_merges = cfast_slic.fast_slic_build_hierarchy(
+                H,
+                W,
+                K,
+                &image[0, 0, 0],
+                <const uint32_t *>&assignments[0, 0],
+                <int32_t *>&merges[0, 0],
+                <float *>&distances[0],
+            )
+        return merges[:num_merges], distances[:num_merges]
+
+    def cut_hierarchy(self, const int32_t[:, ::1] merges, const int32_t[:, ::1] assignments, int num_regions):
+        """Label map of num_regions regions (or as few as merges allow) from the dendrogram of build_hierarchy."""
+        cdef int K = self.num_components
+        cdef np.ndarray[np.uint32_t, ndim=1, mode='c'] labels = np.zeros([K], dtype=np.uint32)
+        cdef const int32_t* c_merges = &merges[0, 0] if merges.shape[0] > 0 else NULL
+        with nogil:
+            cfast_slic.fast_slic_cut_hierarchy(K, merges.shape[0], c_merges, num_regions, <uint32_t *>&labels[0])
+        # Unassigned pixels (-1) stay -1 instead of wrapping around to the last cluster
+        assignment_array = np.asarray(assignments)
+        result = labels.astype(np.int32)[np.maximum(assignment_array, 0)]
+        result[assignment_array < 0] = -1
+        return result
+
+    def estimate_motion(self, const uint8_t [:, :, ::1] prev_image, const uint8_t [:, :, ::1] image, const int32_t[:, ::1] prev_assignment, int search_radius=4):
+        """Estimates the displacement of each cluster from prev_image to image.
+
+        Each cluster is matched by the mean absolute difference over its pixels in prev_assignment, searching every
+        displacement within search_radius; pixels that the displacement moves out of the image are left out.
+        Returns an int16 array of shape [K, 2] holding (dy, dx) of each cluster.
+        """
+        cdef int H = image.shape[0]
+        cdef int W = image.shape[1]
+        cdef int K = self.num_components
+        if image.shape[2] != 3 or prev_image.shape[2] != 3:
+            raise ValueError("nchan != 3")
+        if prev_image.shape[0] != H or prev_image.shape[1] != W or prev_assignment.shape[0] != H or prev_assignment.shape[1] != W:
+            raise ValueError("The shapes of the frames and prev_assignment do not match")
+        cdef np.ndarray[np.int16_t, ndim=2, mode='c'] motion = np.zeros([K, 2], dtype=np.int16)
+        if self._get_name() == 'standard':
+            with nogil:
+                cfast_slic.fast_slic_estimate_motion(H, W, K, &prev_image[0, 0, 0], &image[0, 0, 0], <const uint32_t *>&prev_assignment[0, 0], search_radius, <int16_t *>&motion[0, 0])
+        elif self._get_name() == 'avx2':
+            with nogil:
+                cfast_slic.fast_slic_estimate_motion_avx2(H, W, K, &prev_image[0, 0, 0], &image[0, 0, 0], <const uint32_t *>&prev_assignment[0, 0], search_radius, <int16_t *>&motion[0, 0])
+        else:
+            raise RuntimeError("Not reachable")
+        return motion
+
+    def move_clusters(self, const int16_t[:, ::1] motion, int H, int W):
+        """Shifts each cluster center by (dy, dx) of motion, clamped to the image."""
+        cdef int K = self.num_components
+        cdef int k, y, x
+        if motion.shape[0] != K or motion.shape[1] != 2:
+            raise ValueError("motion must be of shape [K, 2]")
+        for k in range(K):
+            y = self._c_clusters[k].y + motion[k, 0]
+            x = self._c_clusters[k].x + motion[k, 1]
+            self._c_clusters[k].y = min(max(y, 0), H - 1)
+            self._c_clusters[k].x = min(max(x, 0), W - 1)
+
 
 
 
@@ -272,6 +547,59 @@ cdef class NodeConnectivity:
             cfast_slic.fast_slic_free_connectivity(self._c_connectivity)
 
 
+ASSOC_SPLIT = cfast_slic.FAST_SLIC_ASSOC_SPLIT
+ASSOC_MERGE = cfast_slic.FAST_SLIC_ASSOC_MERGE
+
+
+
+def auto_quantize_level(const uint8_t [:, :, ::1] image, float compactness):
+    """Highest quantize_level under which no distance over image saturates, given its channel ranges and compactness."""
+    if image.shape[2] != 3:
+        raise ValueError("nchan != 3")
+    return cfast_slic.fast_slic_auto_quantize_level(image.shape[0], image.shape[1], compactness, &image[0, 0, 0])
+
+
+# Kernels without iterations, and kernels with their own buffers (no boundary band and bounds modes)
+NON_ITERATIVE_ALGORITHMS = ('snic', 'seeds')
+SEPARATE_BUFFER_ALGORITHMS = ('tiled',)
+DEFAULT_ALGORITHMS = (None, 'cluster_oriented')
+KNOWN_ALGORITHMS = DEFAULT_ALGORITHMS + SEPARATE_BUFFER_ALGORITHMS + NON_ITERATIVE_ALGORITHMS
+
+
+def check_options(incremental=False, adaptive=False, depth=False, pyramid_levels=0, band_start_iter=0, bound_start_iter=0, subsample_iters=0, algorithm=None, extent_margin=0):
+    """Raises ValueError for modes that cannot run together, which the kernels would otherwise drop silently."""
+    values = {'pyramid_levels': pyramid_levels, 'band_start_iter': band_start_iter,
+              'bound_start_iter': bound_start_iter, 'subsample_iters': subsample_iters, 'extent_margin': extent_margin}
+    # The kernels fall back to cluster_oriented on a name they do not know
+    if algorithm not in KNOWN_ALGORITHMS:
+        raise ValueError("unknown algorithm {!r}, expected one of {}".format(algorithm, ', '.join(repr(a) for a in KNOWN_ALGORITHMS[1:])))
+    if algorithm in NON_ITERATIVE_ALGORITHMS:
+        reason, excluded = "algorithm={!r}".format(algorithm), ('pyramid_levels', 'band_start_iter', 'bound_start_iter', 'subsample_iters', 'extent_margin')
+    elif algorithm in SEPARATE_BUFFER_ALGORITHMS:
+        reason, excluded = "algorithm={!r}".format(algorithm), ('pyramid_levels', 'band_start_iter', 'bound_start_iter', 'extent_margin')
+    elif pyramid_levels:
+        # The fine stage of the pyramid runs its own boundary band
+        reason, excluded = "pyramid_levels", ('band_start_iter', 'bound_start_iter', 'subsample_iters', 'extent_margin')
+    elif band_start_iter:
+        reason, excluded = "band_start_iter", ('bound_start_iter',)
+    else:
+        reason, excluded = None, ()
+    for name in excluded:
+        if values[name]:
+            raise ValueError("{} cannot be combined with {}".format(name, reason))
+    # Adaptive density and depth only run on the cluster-oriented kernel, the incremental mode on its plain iterations
+    if incremental and (adaptive or depth):
+        raise ValueError("incremental cannot be combined with {}".format('adaptive density' if adaptive else 'depth'))
+    for mode, enabled in (('incremental', incremental), ('adaptive density', adaptive), ('depth', depth)):
+        if not enabled:
+            continue
+        if algorithm not in DEFAULT_ALGORITHMS:
+            raise ValueError("{} cannot be combined with algorithm={!r}".format(mode, algorithm))
+        for name in ('pyramid_levels', 'band_start_iter', 'bound_start_iter') + (('subsample_iters', 'extent_margin') if incremental else ()):
+            if values[name]:
+                raise ValueError("{} cannot be combined with {}".format(mode, name))
+
+
 def slic_supports_arch(name):
     if name == 'avx2':
         return cfast_slic.fast_slic_supports_avx2() == 1
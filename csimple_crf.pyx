@@ -7,7 +7,7 @@ cimport cfast_slic as cs
 
 from libc.stdlib cimport malloc, free
 from libc.string cimport memset
-from libc.stdint cimport uint32_t, int32_t
+from libc.stdint cimport uint8_t, uint32_t, int32_t
 from libcpp.vector cimport vector
 from cython.operator cimport dereference as deref, preincrement
 
@@ -22,6 +22,9 @@ cdef extern from "simple-crf.hpp":
         float spatial_sxy
         float spatial_smooth_w
         float spatial_smooth_sxy
+        float refine_w
+        float refine_sxy
+        float refine_srgb
 
     cdef cppclass CSimpleCRFFrame "SimpleCRFFrame":
         simple_crf_time_t time
@@ -33,6 +36,8 @@ cdef extern from "simple-crf.hpp":
         void get_clusters(cs.Cluster* clusters)
         void set_connectivity(const cs.Connectivity* conn)
         const vector[int]& connected_nodes(int node) except +
+        void set_temporal_correspondence(const int* prev_nodes)
+        int prev_node(int node)
 
         void get_unary(float *unaries_out) const
         void set_unbiased()
@@ -42,6 +47,7 @@ cdef extern from "simple-crf.hpp":
 
         void get_inferred(float *out) const
         void reset_inferred() nogil
+        void refine_pixels(int H, int W, const uint8_t* image, const uint32_t* assignment, size_t max_iter, float* probas) nogil
 
         size_t space_size()
         float calc_temporal_pairwise_energy(int node, const CSimpleCRFFrame& other) nogil
@@ -57,6 +63,7 @@ cdef extern from "simple-crf.hpp":
         simple_crf_time_t pop_frame()
         CSimpleCRFFrame& get_frame(simple_crf_time_t time) except +
         CSimpleCRFFrame& push_frame() except +
+        CSimpleCRFFrame& push_slic_frame(int H, int W, int K, const cs.Cluster* clusters, const uint32_t* assignment, size_t knn, const float* probas, const float* unaries) except + nogil
         size_t space_size()
         void initialize() nogil
         void inference(size_t max_iter) nogil
@@ -173,6 +180,21 @@ cdef class SimpleCRFFrame:
 
 
 
+    def set_temporal_correspondence(self, prev_nodes):
+        """Sets the node of the previous frame matched to each node (-1: none), e.g. from
+        SlicModel.associate_clusters. None restores the default identity correspondence."""
+        cdef int[::1] c_prev_nodes
+        if prev_nodes is None:
+            self._c_frame.set_temporal_correspondence(NULL)
+            return
+        c_prev_nodes = np.ascontiguousarray(prev_nodes, dtype=np.intc)
+        if <size_t>c_prev_nodes.shape[0] != self._c_frame.num_nodes:
+            raise ValueError("Expected len(prev_nodes) to be {}".format(self.num_nodes))
+        self._c_frame.set_temporal_correspondence(&c_prev_nodes[0])
+
+    def get_temporal_correspondence(self):
+        return [self._c_frame.prev_node(i) for i in range(self._c_frame.num_nodes)]
+
     @unaries.setter
     def unaries(self, float[:,::1] new_value):
         self._check_demension(new_value)
@@ -206,6 +228,22 @@ cdef class SimpleCRFFrame:
     def reset_inferred(self):
         self._c_frame.reset_inferred()
 
+    def refine_pixels(self, const uint8_t[:, :, ::1] image, const int32_t[:, ::1] assignment, size_t max_iter=5):
+        cdef int H = image.shape[0]
+        cdef int W = image.shape[1]
+        if image.shape[2] != 3:
+            raise ValueError("nchan != 3")
+        if assignment.shape[0] != H or assignment.shape[1] != W:
+            raise ValueError("The shape of assignment does not match the one of image")
+        cdef np.ndarray[np.float32_t, ndim=3, mode='c'] probas = np.empty(
+            [self._c_frame.num_classes, H, W],
+            dtype=np.float32
+        )
+        if H > 0 and W > 0:
+            with nogil:
+                self._c_frame.refine_pixels(H, W, &image[0, 0, 0], <const uint32_t *>&assignment[0, 0], max_iter, &probas[0, 0, 0])
+        return probas
+
     def temporal_pairwise_energy(self, int node_i, SimpleCRFFrame other):
         cdef float result
         if not isinstance(other, SimpleCRFFrame):
@@ -301,6 +339,30 @@ cdef class SimpleCRF:
     def spatial_smooth_sxy(self, float spatial_smooth_sxy):
         self._c_crf.params.spatial_smooth_sxy = spatial_smooth_sxy
 
+    @property
+    def refine_w(self):
+        return self._c_crf.params.refine_w
+
+    @refine_w.setter
+    def refine_w(self, float refine_w):
+        self._c_crf.params.refine_w = refine_w
+
+    @property
+    def refine_sxy(self):
+        return self._c_crf.params.refine_sxy
+
+    @refine_sxy.setter
+    def refine_sxy(self, float refine_sxy):
+        self._c_crf.params.refine_sxy = refine_sxy
+
+    @property
+    def refine_srgb(self):
+        return self._c_crf.params.refine_srgb
+
+    @refine_srgb.setter
+    def refine_srgb(self, float refine_srgb):
+        self._c_crf.params.refine_srgb = refine_srgb
+
     @property
     def first_time(self):
         return self._c_crf.get_first_time()
@@ -323,15 +385,37 @@ cdef class SimpleCRF:
         result._c_frame = frame
         return result
 
-    cpdef push_slic_frame(self, slic, knn=None):
-        frame = self.push_frame()
-        frame.set_yxmrgb(slic.slic_model.to_yxmrgb())
-        if knn is None:
-            frame.set_connectivity(slic.slic_model.get_connectivity(slic.last_assignment))
-        else:
-            frame.set_connectivity(slic.slic_model.get_knn_connectivity(slic.last_assignment, knn))
-        frame.set_unbiased()
-        return frame
+    cpdef push_slic_frame(self, slic, knn=None, float[:, ::1] unaries=None, const float[:, :, ::1] probas=None):
+        """Pushes a frame built from the last iterate of slic: its clusters, their adjacency (or their knn nearest
+        centers) and unaries, either per node ([num_classes, num_nodes]) or pooled from pixel probabilities
+        ([num_classes, H, W]). Everything past the argument checks runs without the GIL.
+        """
+        if slic.last_assignment is None:
+            raise ValueError("slic has not been iterated yet")
+        cdef cs.BaseSlicModel slic_model = slic.slic_model
+        cdef const int32_t[:, ::1] assignment = slic.last_assignment
+        cdef const float* c_unaries = NULL
+        cdef const float* c_probas = NULL
+        cdef size_t c_knn = 0 if knn is None else knn
+        cdef CSimpleCRFFrame* frame
+        cdef SimpleCRFFrame result
+        cdef int H = assignment.shape[0]
+        cdef int W = assignment.shape[1]
+
+        if unaries is not None:
+            if <size_t>unaries.shape[1] != <size_t>slic_model.num_components or <size_t>(unaries.shape[0] * unaries.shape[1]) != self._c_crf.space_size():
+                raise ValueError("The shape of unaries should be [num_classes, num_nodes]")
+            c_unaries = &unaries[0, 0]
+        if probas is not None:
+            if probas.shape[1] != H or probas.shape[2] != W or <size_t>probas.shape[0] * <size_t>slic_model.num_components != self._c_crf.space_size():
+                raise ValueError("The shape of probas should be [num_classes, H, W]")
+            c_probas = &probas[0, 0, 0]
+
+        with nogil:
+            frame = &self._c_crf.push_slic_frame(H, W, slic_model.num_components, slic_model._c_clusters, <const uint32_t *>&assignment[0, 0], c_knn, c_probas, c_unaries)
+        result = SimpleCRFFrame(self)
+        result._c_frame = frame
+        return result
 
     cpdef push_frame(self):
         cdef CSimpleCRFFrame* frame = &self._c_crf.push_frame()
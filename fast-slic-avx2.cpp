@@ -6,18 +6,52 @@
 #ifdef USE_AVX2
 #include <immintrin.h>
 
+// Incremental mode compares frames in 16x16 tiles
+static const int incremental_tile_shift = 4;
+
+// Tiled mode stores tiles of 64 x 16 pixels contiguously
+static const int tiled_width_shift = 6;
+static const int tiled_height_shift = 4;
+static const int tiled_size = 1 << (tiled_width_shift + tiled_height_shift);
+
 class Context : public BaseContext {
 public:
-    uint8_t* __restrict__ aligned_quad_image_base = nullptr;
-    uint8_t* __restrict__ aligned_quad_image = nullptr; // copied image
-    uint16_t quad_image_memory_width;
+    uint8_t* __restrict__ aligned_rgb_image_base = nullptr;
+    uint8_t* __restrict__ aligned_rgb_image = nullptr; // copied image, packed RGB
+    int rgb_image_memory_width = 0;
     uint32_t* __restrict__ aligned_assignment_base = nullptr;
     uint32_t* __restrict__ aligned_assignment = nullptr;
-    int assignment_memory_width; // memory width of aligned_assignment
+    int assignment_memory_width = 0; // memory width of aligned_assignment
+    // Incremental mode: tile change map and clusters to re-run (nullptr in full mode)
+    const uint8_t* __restrict__ changed_tiles = nullptr;
+    const uint8_t* __restrict__ dirty_clusters = nullptr;
+    int num_tile_cols;
+    // Region scanned by slic_update_clusters ([0, H) x [0, W) in full mode)
+    int update_y_lo, update_y_hi, update_x_lo, update_x_hi;
+    // Only every row_step-th image row (a power of two) is assigned and accumulated
+    int row_step = 1;
+    // Extent mode: slic_update_clusters records the member box of each cluster while extent_margin > 0,
+    // and the cluster-oriented kernel only scans the part of the window within extent_margin of it
+    int extent_margin = 0;
+    std::vector<ClusterBox> cluster_extents;
+    // Volumes (D > 0): slice of each cluster. The padded slices are stacked, slice z starting
+    // slice_memory_height rows after slice z - 1 in both the RGB image and the assignment.
+    uint16_t* __restrict__ cluster_z = nullptr;
+    int slice_memory_height = 0;
+    // RGB-D mode: depth quantized to 8 bits (the 4th byte of the cluster color quads), padded like the
+    // assignment and with the same memory width. nullptr without depth.
+    std::vector<uint8_t> depth_plane;
+    const uint8_t* __restrict__ aligned_depth = nullptr;
+    // Saturation telemetry: the cluster-oriented kernel adds the number of distances clamped to 65535 (nullptr: off)
+    uint64_t* num_saturated = nullptr;
+    // Tiled mode: packed RGB image and assignment stored tile by tile (see tiled_index), without padding
+    int num_tiled_cols = 0;
+    std::vector<uint8_t> tiled_rgb_image;
+    std::vector<uint32_t> tiled_assignment;
 public:
     virtual ~Context() {
-        if (aligned_quad_image_base) {
-            simd_helper::free_aligned_array(aligned_quad_image_base);
+        if (aligned_rgb_image_base) {
+            simd_helper::free_aligned_array(aligned_rgb_image_base);
         }
         if (aligned_assignment_base) {
             simd_helper::free_aligned_array(aligned_assignment_base);
@@ -25,14 +59,25 @@ public:
     }
 };
 
+// Loads 8 packed RGB pixels (24 bytes) and spreads them to one pixel per 32-bit lane, with a zero high byte
+static inline __m256i load_rgb_segment(const uint8_t* img_rgb_row) {
+    const __m256i lane_spread = _mm256_set_epi32(0, 5, 4, 3, 0, 2, 1, 0);
+    const __m256i byte_spread = _mm256_set_epi8(
+        -1, 11, 10, 9, -1, 8, 7, 6, -1, 5, 4, 3, -1, 2, 1, 0,
+        -1, 11, 10, 9, -1, 8, 7, 6, -1, 5, 4, 3, -1, 2, 1, 0
+    );
+    __m256i segment = _mm256_loadu_si256((const __m256i *)img_rgb_row);
+    return _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(segment, lane_spread), byte_spread);
+}
+
 static inline
 __m256i get_assignment_value_vec(
         const Cluster* cluster, uint8_t quantize_level, const uint16_t* __restrict__ spatial_dist_patch,
         int patch_memory_width,
         int i, int j, int patch_virtual_width,
-        const uint8_t* img_quad_row, const uint16_t* spatial_dist_patch_row,
+        const uint8_t* img_rgb_row, const uint16_t* spatial_dist_patch_row,
         __m256i cluster_number_vec, __m256i cluster_color_vec64, __m256i cluster_color_vec,
-        __m256i color_swap_mask, __m128i sad_duplicate_mask
+        const uint8_t* depth_row = nullptr
         ) {
 #ifdef FAST_SLIC_SIMD_INVARIANCE_CHECK
     assert((long long)(spatial_dist_patch_row) % 16 == 0);
@@ -46,25 +91,34 @@ __m256i get_assignment_value_vec(
     //   8 elements of uint32_t
     //   [high 16-bit: distance value] + [low 16-bit: cluster_number]
 
+    // Gathers the SADs of the 64-bit lanes into the low half
+    const __m256i color_swap_mask = _mm256_set_epi32(7, 7, 7, 7, 6, 4, 2, 0);
+
     __m128i spatial_dist_vec__narrow = _mm_load_si128((__m128i *)spatial_dist_patch_row);
 #ifdef FAST_SLIC_SIMD_INVARIANCE_CHECK
     {
         uint16_t spatial_dists[8];
         _mm_storeu_si128((__m128i*)spatial_dists, spatial_dist_vec__narrow);
-        for (int delta = 0; delta < 8; delta++) {
+        // Lanes outside the window may come from a padded copy of the patch
+        for (int delta = my_max(0, -j); delta < my_min(8, patch_virtual_width - j); delta++) {
             assert(spatial_dists[delta] == spatial_dist_patch[patch_memory_width * i + (j + delta)]);
         }
     }
 #endif
 
-    __m256i image_segment = _mm256_loadu_si256((__m256i*)img_quad_row);
+    __m256i image_segment = load_rgb_segment(img_rgb_row);
+    if (depth_row != nullptr) {
+        // RGB-D mode: the quantized depth fills the zero 4th byte of each quad, so the SAD below includes it
+        __m256i depth_segment = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)depth_row));
+        image_segment = _mm256_or_si256(image_segment, _mm256_slli_epi32(depth_segment, 24));
+    }
 
 #ifdef FAST_SLIC_SIMD_INVARIANCE_CHECK
     {
         uint8_t s[32];
         _mm256_storeu_si256((__m256i *)s, image_segment);
-        for (int v = 0; v < 4 * my_min(8, patch_virtual_width - j); v++) {
-            if (s[v] != img_quad_row[v]) {
+        for (int v = 0; v < my_min(8, patch_virtual_width - j); v++) {
+            if (s[4 * v] != img_rgb_row[3 * v] || s[4 * v + 1] != img_rgb_row[3 * v + 1] || s[4 * v + 2] != img_rgb_row[3 * v + 2] || s[4 * v + 3] != (depth_row ? depth_row[v] : 0)) {
                 abort();
             }
         }
@@ -72,6 +126,8 @@ __m256i get_assignment_value_vec(
 #endif
 
 #ifdef FAST_SLIC_AVX2_FASTER
+    // Spreads each SAD over the two pixels it covers
+    const __m128i sad_duplicate_mask = _mm_set_epi8(13, 12, 13, 12, 9, 8, 9, 8, 5, 4, 5, 4, 1, 0, 1, 0);
     __m256i sad = _mm256_sad_epu8(image_segment, cluster_color_vec);
     __m128i shrinked__narrow = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(sad, color_swap_mask));
     __m128i duplicate__narrow = _mm_shuffle_epi8(shrinked__narrow, sad_duplicate_mask);
@@ -96,10 +152,11 @@ __m256i get_assignment_value_vec(
         uint16_t shorts[8];
         _mm_storeu_si128((__m128i *)shorts, color_dist_vec__narrow);
         for (int v = 0; v < my_min(8, patch_virtual_width - j); v++) {
-            int dr = fast_abs<int>((int)img_quad_row[4 * v + 0] - (int)cluster->r);
-            int dg = fast_abs<int>((int)img_quad_row[4 * v + 1] - (int)cluster->g);
-            int db= fast_abs<int>((int)img_quad_row[4 * v + 2] - (int)cluster->b);
-            int dist = (dr + dg + db) << quantize_level;
+            int dr = fast_abs<int>((int)img_rgb_row[3 * v + 0] - (int)cluster->r);
+            int dg = fast_abs<int>((int)img_rgb_row[3 * v + 1] - (int)cluster->g);
+            int db= fast_abs<int>((int)img_rgb_row[3 * v + 2] - (int)cluster->b);
+            int dd = depth_row ? fast_abs<int>((int)depth_row[v] - (int)cluster->reserved[0]) : 0;
+            int dist = (dr + dg + db + dd) << quantize_level;
             assert((int)shorts[v] == dist);
         }
     }
@@ -109,13 +166,15 @@ __m256i get_assignment_value_vec(
         {
             uint16_t dists[8];
             _mm_storeu_si128((__m128i*)dists, dist_vec__narrow);
-            for (int v = 0; v < my_min(8, patch_virtual_width - j); v++) {
+            for (int v = my_max(0, -j); v < my_min(8, patch_virtual_width - j); v++) {
+                // The sum saturates at 65535
                 assert(
                         (int)dists[v] ==
-                        ((int)spatial_dist_patch[patch_memory_width * i + (j + v)] +
-                         ((fast_abs<int>(img_quad_row[4 * v + 0]  - cluster->r) +
-                           fast_abs<int>(img_quad_row[4 * v + 1] - cluster->g) +
-                           fast_abs<int>(img_quad_row[4 * v + 2] - cluster->b)) << quantize_level)
+                        my_min(65535, (int)spatial_dist_patch[patch_memory_width * i + (j + v)] +
+                         ((fast_abs<int>(img_rgb_row[3 * v + 0]  - cluster->r) +
+                           fast_abs<int>(img_rgb_row[3 * v + 1] - cluster->g) +
+                           fast_abs<int>(img_rgb_row[3 * v + 2] - cluster->b) +
+                           (depth_row ? fast_abs<int>(depth_row[v] - cluster->reserved[0]) : 0)) << quantize_level)
                         )
                       );
             }
@@ -148,19 +207,14 @@ static void slic_assign_cluster_oriented(Context *context) {
     auto quantize_level = context->quantize_level;
     const int16_t S = context->S;
 
-    const uint8_t* __restrict__ aligned_quad_image = context->aligned_quad_image;
-    const uint16_t* __restrict__ spatial_dist_patch = (const uint16_t* __restrict__)HINT_ALIGNED(context->spatial_dist_patch);
+    const uint8_t* __restrict__ aligned_rgb_image = context->aligned_rgb_image;
     uint32_t* __restrict__ aligned_assignment = context->aligned_assignment;
+    const uint8_t* __restrict__ aligned_depth = context->aligned_depth;
+    const bool count_saturation = context->num_saturated != nullptr;
+    uint64_t num_saturated = 0;
 
-    auto quad_image_memory_width = context->quad_image_memory_width;
-
-    // might help to initialize array
-#ifdef FAST_SLIC_SIMD_INVARIANCE_CHECK
-    assert((long long)spatial_dist_patch % 32 == 0);
-#endif
-
-    const uint16_t patch_height = 2 * S + 1, patch_virtual_width = 2 * S + 1;
-    const uint16_t patch_memory_width = simd_helper::align_to_next(patch_virtual_width);
+    auto rgb_image_memory_width = context->rgb_image_memory_width;
+    const int row_step = context->row_step;
 
 
     // Sorting clusters by morton order seems to help for distributing clusters evenly for multiple cores
@@ -170,52 +224,74 @@ static void slic_assign_cluster_oriented(Context *context) {
     {
         cluster_sorted_tuples.reserve(K);
         for (int k = 0; k < K; k++) {
+            if (context->dirty_clusters && !context->dirty_clusters[k]) continue;
             const Cluster* cluster = &clusters[k];
             uint32_t score = get_sort_value(cluster->y, cluster->x, S);
             cluster_sorted_tuples.push_back(ZOrderTuple(score, cluster));
         }
         std::sort(cluster_sorted_tuples.begin(), cluster_sorted_tuples.end());
     }
+    const int num_sorted_clusters = (int)cluster_sorted_tuples.size();
 
     // auto t1 = Clock::now();
-    __m256i color_swap_mask =  _mm256_set_epi32(
-        7, 7, 7, 7,
-        6, 4, 2, 0
-
-    );
-    __m128i sad_duplicate_mask = _mm_set_epi8(
-        13, 12, 13, 12,
-        9, 8, 9, 8,
-        5, 4, 5, 4,
-        1, 0, 1, 0
-    );
-
  
-    #pragma omp parallel for schedule(static)
-    for (int cluster_sorted_idx = 0; cluster_sorted_idx < K; cluster_sorted_idx++) {
+    #pragma omp parallel for schedule(static) reduction(+:num_saturated)
+    for (int cluster_sorted_idx = 0; cluster_sorted_idx < num_sorted_clusters; cluster_sorted_idx++) {
         const Cluster *cluster = cluster_sorted_tuples[cluster_sorted_idx].cluster;
         cluster_no_t cluster_number = cluster->number;
         const int16_t cluster_y = cluster->y, cluster_x = cluster->x;
-        const int16_t y_lo = cluster_y - S, x_lo = cluster_x - S;
+        // Adaptive density: the window and the spatial scale follow the cluster's own size
+        const int16_t cluster_S = context->cluster_S ? context->cluster_S[cluster_number] : S;
+        const int16_t y_lo = cluster_y - cluster_S, x_lo = cluster_x - cluster_S;
+        const uint16_t* __restrict__ spatial_dist_patch = (const uint16_t* __restrict__)HINT_ALIGNED(context->get_spatial_patch(cluster_number)->dist_patch);
+#ifdef FAST_SLIC_SIMD_INVARIANCE_CHECK
+        assert((long long)spatial_dist_patch % 32 == 0);
+#endif
+        const uint16_t patch_height = 2 * cluster_S + 1, patch_virtual_width = 2 * cluster_S + 1;
+        const uint16_t patch_memory_width = simd_helper::align_to_next(patch_virtual_width);
+        const uint16_t patch_virtual_width_multiple8 = patch_virtual_width & 0xFFF8;
+
+        // Rows and columns of the window to scan. Columns start at a multiple of 8 to keep the patch loads aligned.
+        int row_lo = 0, row_hi = patch_height, col_lo = 0, col_end = patch_virtual_width_multiple8;
+        bool scan_tail = patch_virtual_width_multiple8 < patch_virtual_width;
+        if (!context->cluster_extents.empty()) {
+            const ClusterBox &box = context->cluster_extents[cluster_number];
+            // A cluster without members keeps its whole window
+            if (box.y_lo < box.y_hi) {
+                const int extent_margin = context->extent_margin;
+                row_lo = my_max(0, box.y_lo - extent_margin - y_lo);
+                row_hi = my_min((int)patch_height, box.y_hi + extent_margin - y_lo);
+                col_lo = my_max(0, box.x_lo - extent_margin - x_lo) & ~7;
+                col_end = my_min((int)patch_virtual_width_multiple8, ceil_int(box.x_hi + extent_margin - x_lo, 8) * 8);
+                scan_tail = scan_tail && box.x_hi + extent_margin - x_lo > patch_virtual_width_multiple8;
+            }
+        }
 
         // Note: x86-64 is little-endian arch. ABGR order is correct.
-        const uint32_t cluster_color_quad = ((uint32_t)cluster->b << 16) + ((uint32_t)cluster->g << 8) + ((uint32_t)cluster->r);
+        uint32_t cluster_color_quad = ((uint32_t)cluster->b << 16) + ((uint32_t)cluster->g << 8) + ((uint32_t)cluster->r);
+        if (aligned_depth) cluster_color_quad |= (uint32_t)cluster->reserved[0] << 24;
         __m256i cluster_color_vec64 = _mm256_set1_epi64x((uint64_t)cluster_color_quad);
         __m256i cluster_color_vec = _mm256_set1_epi32((uint32_t)cluster_color_quad);
         // 16 elements uint16_t (among there elements are the first 8 elements used)
         __m256i cluster_number_vec = _mm256_set1_epi32((uint32_t)cluster_number);
+        // Saturation telemetry: each lane subtracts the all-ones compare results of its saturated distances
+        const __m256i saturated_dist_vec = _mm256_set1_epi32(0xFFFF);
+        __m256i saturated_count_vec = _mm256_setzero_si256();
 
-        for (int16_t i = 0; i < patch_height; i++) {
+        // First sampled image row of the window
+        row_lo += -(y_lo + row_lo) & (row_step - 1);
+        for (int16_t i = row_lo; i < row_hi; i += row_step) {
             const uint16_t* spatial_dist_patch_base_row = spatial_dist_patch + patch_memory_width * i;
 #ifdef FAST_SLIC_SIMD_INVARIANCE_CHECK
             assert((long long)spatial_dist_patch_base_row % 32 == 0);
 #endif
             // not aligned
-            const uint8_t *img_quad_base_row = aligned_quad_image + quad_image_memory_width * (y_lo + i) + 4 * x_lo;
+            const uint8_t *img_rgb_base_row = aligned_rgb_image + rgb_image_memory_width * (y_lo + i) + 3 * x_lo;
             uint32_t* assignment_base_row = aligned_assignment + (i + y_lo) * assignment_memory_width + x_lo;
+            const uint8_t* depth_base_row = aligned_depth ? aligned_depth + (i + y_lo) * assignment_memory_width + x_lo : nullptr;
 
-#define ASSIGNMENT_VALUE_GETTER_BODY const uint16_t* spatial_dist_patch_row; const uint8_t* img_quad_row; uint32_t* assignment_row; __m256i assignment_value_vec; { \
-    img_quad_row = img_quad_base_row + 4 * j; /*Image rows are not aligned due to x_lo*/ \
+#define ASSIGNMENT_VALUE_GETTER_BODY const uint16_t* spatial_dist_patch_row; const uint8_t* img_rgb_row; uint32_t* assignment_row; __m256i assignment_value_vec; { \
+    img_rgb_row = img_rgb_base_row + 3 * j; /*Image rows are not aligned due to x_lo*/ \
     spatial_dist_patch_row = spatial_dist_patch_base_row + j; /* Spatial distance patch is aligned */ \
     spatial_dist_patch_row = (uint16_t *)HINT_ALIGNED_AS(spatial_dist_patch_row, 16); \
     assignment_row = assignment_base_row + j; /* unaligned */ \
@@ -225,30 +301,37 @@ static void slic_assign_cluster_oriented(Context *context) {
         spatial_dist_patch, \
         patch_memory_width, \
         i, j, patch_virtual_width, \
-        img_quad_row, \
+        img_rgb_row, \
         spatial_dist_patch_row, \
         cluster_number_vec, \
         cluster_color_vec64, \
         cluster_color_vec, \
-        color_swap_mask, \
-        sad_duplicate_mask \
+        depth_base_row ? depth_base_row + j : nullptr \
     ); \
 }
-            const uint16_t patch_virtual_width_multiple8 = patch_virtual_width & 0xFFF8;
-            // 32(batch size) / 4(rgba quad) = stride 8 
+            // 8 pixels per step, spread to RGBA quads by load_rgb_segment
             #pragma unroll(4)
             #pragma GCC unroll(4)
-            for (int j = 0; j < patch_virtual_width_multiple8; j += 8) {
+            for (int j = col_lo; j < col_end; j += 8) {
                 ASSIGNMENT_VALUE_GETTER_BODY
+                if (count_saturation) {
+                    __m256i saturated = _mm256_cmpeq_epi32(_mm256_srli_epi32(assignment_value_vec, 16), saturated_dist_vec);
+                    saturated_count_vec = _mm256_sub_epi32(saturated_count_vec, saturated);
+                }
                 // min-assignment
                 // Race condition is here. But who cares?
                 __m256i min_assignment_vec = _mm256_min_epu32(_mm256_loadu_si256((__m256i*)assignment_row), assignment_value_vec);
                 _mm256_storeu_si256((__m256i*)assignment_row, min_assignment_vec);
             }
 
-            if (patch_virtual_width_multiple8 < patch_virtual_width) {
+            if (scan_tail) {
                 int j = patch_virtual_width_multiple8;
                 ASSIGNMENT_VALUE_GETTER_BODY
+                if (count_saturation) {
+                    __m256i in_window = _mm256_cmpgt_epi32(_mm256_set1_epi32(patch_virtual_width - j), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+                    __m256i saturated = _mm256_cmpeq_epi32(_mm256_srli_epi32(assignment_value_vec, 16), saturated_dist_vec);
+                    saturated_count_vec = _mm256_sub_epi32(saturated_count_vec, _mm256_and_si256(saturated, in_window));
+                }
                 ALIGN_SIMD uint32_t calcd_values[8];
                 _mm256_store_si256((__m256i *)calcd_values, assignment_value_vec);
                 const int max_V = patch_virtual_width - j;
@@ -259,27 +342,265 @@ static void slic_assign_cluster_oriented(Context *context) {
                 }
             }
         }
+
+        if (count_saturation) {
+            ALIGN_SIMD uint32_t counts[8];
+            _mm256_store_si256((__m256i *)counts, saturated_count_vec);
+            for (int v = 0; v < 8; v++) num_saturated += counts[v];
+        }
     }
+    if (count_saturation) *context->num_saturated += num_saturated;
     // auto t2 = Clock::now();
     // std::cerr << "Sort: " << std::chrono::duration_cast<std::chrono::microseconds>(t1-t0).count() << "us \n";
     // std::cerr << "Tightloop: " << std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us \n";
 }
 
+// Copies the spatial distance patch with 8 columns of padding on both sides, so that rows can be loaded at any offset
+static int build_padded_patch(const Context *context, std::vector<uint16_t> &padded_patch) {
+    const int patch_virtual_width = 2 * context->S + 1, patch_memory_width = simd_helper::align_to_next(patch_virtual_width);
+    const int padded_patch_width = patch_virtual_width + 16;
+    padded_patch.assign((size_t)patch_virtual_width * padded_patch_width, 0);
+    for (int i = 0; i < patch_virtual_width; i++) {
+        std::copy_n(context->spatial_dist_patch + patch_memory_width * i, patch_virtual_width, &padded_patch[(size_t)padded_patch_width * i + 8]);
+    }
+    return padded_patch_width;
+}
+
+// Offset of pixel (i, j) in the buffers of the tiled mode
+static inline size_t tiled_index(const Context *context, int i, int j) {
+    const size_t tile = (size_t)(i >> tiled_height_shift) * context->num_tiled_cols + (j >> tiled_width_shift);
+    return tile * tiled_size + ((i & ((1 << tiled_height_shift) - 1)) << tiled_width_shift) + (j & ((1 << tiled_width_shift) - 1));
+}
+
+// Copies the caller's image into tiles. The tiles past the right and bottom edges are left zero.
+static void prepare_tiled(Context *context) {
+    const int H = context->H, W = context->W;
+    const int num_tiled_rows = ceil_int(H, 1 << tiled_height_shift);
+    context->num_tiled_cols = ceil_int(W, 1 << tiled_width_shift);
+    const size_t buffer_size = (size_t)num_tiled_rows * context->num_tiled_cols * tiled_size;
+    // Segments are loaded 32 bytes at a time for 24 bytes of pixels, hence the slack
+    context->tiled_rgb_image.assign(3 * buffer_size + 32, 0);
+    context->tiled_assignment.assign(buffer_size, 0xFFFFFFFF);
+    #pragma omp parallel for
+    for (int i = 0; i < H; i++) {
+        for (int j = 0; j < W; j += 1 << tiled_width_shift) {
+            std::memcpy(
+                &context->tiled_rgb_image[3 * tiled_index(context, i, j)],
+                &context->image[3 * ((size_t)W * i + j)],
+                3 * my_min(1 << tiled_width_shift, W - j)
+            );
+        }
+    }
+}
+
+// Assignment of the tiled mode. Each window is clipped to the image and walked tile by tile, so that
+// consecutive rows of a window fall into the same few kilobytes instead of one cache line per image row.
+// Segments start at multiples of 8 in image coordinates; the lanes outside the window are masked out.
+static void slic_assign_tiled(Context *context) {
+    const int H = context->H, W = context->W, K = context->K, S = context->S;
+    const Cluster* clusters = context->clusters;
+    const uint8_t quantize_level = context->quantize_level;
+    const int row_step = context->row_step;
+    const int patch_virtual_width = 2 * S + 1;
+    const int patch_memory_width = simd_helper::align_to_next(patch_virtual_width);
+    const int tile_width = 1 << tiled_width_shift, tile_height = 1 << tiled_height_shift;
+    const uint8_t* tiled_rgb_image = context->tiled_rgb_image.data();
+    uint32_t* tiled_assignment = context->tiled_assignment.data();
+
+    std::vector<uint16_t> padded_patch;
+    const int padded_patch_width = build_padded_patch(context, padded_patch);
+
+    const __m256i lane_offsets = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < K; k++) {
+        const Cluster* cluster = &clusters[k];
+        const int y_lo = my_max(0, cluster->y - S), y_hi = my_min(H, cluster->y + S + 1);
+        const int x_lo = my_max(0, cluster->x - S), x_hi = my_min(W, cluster->x + S + 1);
+        if (y_lo >= y_hi || x_lo >= x_hi) continue;
+        const uint32_t cluster_color_quad = ((uint32_t)cluster->b << 16) + ((uint32_t)cluster->g << 8) + ((uint32_t)cluster->r);
+        __m256i cluster_color_vec64 = _mm256_set1_epi64x((uint64_t)cluster_color_quad);
+        __m256i cluster_color_vec = _mm256_set1_epi32((uint32_t)cluster_color_quad);
+        __m256i cluster_number_vec = _mm256_set1_epi32((uint32_t)cluster->number);
+        const __m256i x_lo_vec = _mm256_set1_epi32(x_lo), x_last_vec = _mm256_set1_epi32(x_hi - 1);
+
+        for (int ty = y_lo >> tiled_height_shift; ty <= (y_hi - 1) >> tiled_height_shift; ty++) {
+            const int i_lo = my_max(y_lo, ty * tile_height), i_hi = my_min(y_hi, (ty + 1) * tile_height);
+            for (int tx = x_lo >> tiled_width_shift; tx <= (x_hi - 1) >> tiled_width_shift; tx++) {
+                const int j_lo = my_max(x_lo, tx * tile_width) & ~7, j_hi = my_min(x_hi, (tx + 1) * tile_width);
+                const size_t tile_offset = ((size_t)ty * context->num_tiled_cols + tx) * tiled_size;
+                for (int i = i_lo + (-i_lo & (row_step - 1)); i < i_hi; i += row_step) {
+                    const int patch_y = i - cluster->y + S;
+                    // Indexed by image column
+                    const uint16_t* patch_row = &padded_patch[padded_patch_width * patch_y + 8 - (cluster->x - S)];
+                    const size_t row_offset = tile_offset + ((i & (tile_height - 1)) << tiled_width_shift);
+                    for (int j = j_lo; j < j_hi; j += 8) {
+                        const size_t offset = row_offset + (j & (tile_width - 1));
+                        ALIGN_SIMD uint16_t spatial_dist_patch_row[8];
+                        std::memcpy(spatial_dist_patch_row, patch_row + j, sizeof(spatial_dist_patch_row));
+                        __m256i assignment_value_vec = get_assignment_value_vec(
+                            cluster, quantize_level, context->spatial_dist_patch, patch_memory_width,
+                            patch_y, j - (cluster->x - S), patch_virtual_width, tiled_rgb_image + 3 * offset, spatial_dist_patch_row,
+                            cluster_number_vec, cluster_color_vec64, cluster_color_vec
+                        );
+                        if (j < x_lo || j + 8 > x_hi) {
+                            const __m256i x_vec = _mm256_add_epi32(_mm256_set1_epi32(j), lane_offsets);
+                            assignment_value_vec = _mm256_or_si256(assignment_value_vec, _mm256_or_si256(
+                                _mm256_cmpgt_epi32(x_lo_vec, x_vec), _mm256_cmpgt_epi32(x_vec, x_last_vec)
+                            ));
+                        }
+                        // Race condition is here, as in slic_assign_cluster_oriented
+                        uint32_t* assignment_row = tiled_assignment + offset;
+                        __m256i min_assignment_vec = _mm256_min_epu32(_mm256_loadu_si256((__m256i*)assignment_row), assignment_value_vec);
+                        _mm256_storeu_si256((__m256i*)assignment_row, min_assignment_vec);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Cluster-oriented kernel over a volume: the window of a cluster is scanned slice by slice,
+// each slice with its own layer of the (2S + 1)^3 spatial patch.
+static void slic_assign_volume(Context *context) {
+    const int D = context->D, K = context->K;
+    const Cluster* clusters = context->clusters;
+    const uint16_t* cluster_z = context->cluster_z;
+    const uint8_t quantize_level = context->quantize_level;
+    const int16_t S = context->S;
+    const uint8_t* __restrict__ aligned_rgb_image = context->aligned_rgb_image;
+    uint32_t* __restrict__ aligned_assignment = context->aligned_assignment;
+    const int rgb_image_memory_width = context->rgb_image_memory_width;
+    const int assignment_memory_width = context->assignment_memory_width;
+    const int slice_memory_height = context->slice_memory_height;
+
+    // Slice first, then Morton order within the slice
+    std::vector<ZOrderTuple> cluster_sorted_tuples;
+    cluster_sorted_tuples.reserve(K);
+    for (int k = 0; k < K; k++) {
+        cluster_sorted_tuples.push_back(ZOrderTuple(get_sort_value(clusters[k].y, clusters[k].x, S), &clusters[k]));
+    }
+    std::sort(cluster_sorted_tuples.begin(), cluster_sorted_tuples.end(), [cluster_z](const ZOrderTuple &lhs, const ZOrderTuple &rhs) {
+        uint16_t lhs_z = cluster_z[lhs.cluster->number], rhs_z = cluster_z[rhs.cluster->number];
+        return lhs_z < rhs_z || (lhs_z == rhs_z && lhs.score < rhs.score);
+    });
+
+
+    const SpatialPatch* patch = context->get_spatial_patch(0);
+    const uint16_t patch_height = 2 * S + 1, patch_virtual_width = 2 * S + 1;
+    const uint16_t patch_memory_width = patch->patch_memory_width;
+    const uint16_t patch_virtual_width_multiple8 = patch_virtual_width & 0xFFF8;
+
+    #pragma omp parallel for schedule(static)
+    for (int cluster_sorted_idx = 0; cluster_sorted_idx < K; cluster_sorted_idx++) {
+        const Cluster *cluster = cluster_sorted_tuples[cluster_sorted_idx].cluster;
+        const cluster_no_t cluster_number = cluster->number;
+        const int cluster_slice = cluster_z[cluster_number];
+        const int y_lo = cluster->y - S, x_lo = cluster->x - S;
+        const int dz_lo = my_max(-S, -cluster_slice), dz_hi = my_min((int)S, D - 1 - cluster_slice);
+
+        // Note: x86-64 is little-endian arch. ABGR order is correct.
+        const uint32_t cluster_color_quad = ((uint32_t)cluster->b << 16) + ((uint32_t)cluster->g << 8) + ((uint32_t)cluster->r);
+        __m256i cluster_color_vec64 = _mm256_set1_epi64x((uint64_t)cluster_color_quad);
+        __m256i cluster_color_vec = _mm256_set1_epi32((uint32_t)cluster_color_quad);
+        __m256i cluster_number_vec = _mm256_set1_epi32((uint32_t)cluster_number);
+
+        for (int dz = dz_lo; dz <= dz_hi; dz++) {
+            const uint16_t* __restrict__ spatial_dist_patch = (const uint16_t* __restrict__)HINT_ALIGNED(
+                patch->dist_patch + (size_t)(dz + S) * patch_height * patch_memory_width
+            );
+            const int slice_row = (cluster_slice + dz) * slice_memory_height;
+            for (int i = 0; i < patch_height; i++) {
+                const uint16_t* spatial_dist_patch_base_row = spatial_dist_patch + patch_memory_width * i;
+                const uint8_t *img_rgb_base_row = aligned_rgb_image + (size_t)rgb_image_memory_width * (slice_row + y_lo + i) + 3 * x_lo;
+                uint32_t* assignment_base_row = aligned_assignment + (size_t)assignment_memory_width * (slice_row + y_lo + i) + x_lo;
+
+                for (int j = 0; j < patch_virtual_width; j += 8) {
+                    __m256i assignment_value_vec = get_assignment_value_vec(
+                        cluster, quantize_level, spatial_dist_patch, patch_memory_width,
+                        i, j, patch_virtual_width,
+                        img_rgb_base_row + 3 * j,
+                        (const uint16_t *)HINT_ALIGNED_AS(spatial_dist_patch_base_row + j, 16),
+                        cluster_number_vec, cluster_color_vec64, cluster_color_vec
+                    );
+                    uint32_t* assignment_row = assignment_base_row + j;
+                    if (j < patch_virtual_width_multiple8) {
+                        __m256i min_assignment_vec = _mm256_min_epu32(_mm256_loadu_si256((__m256i*)assignment_row), assignment_value_vec);
+                        _mm256_storeu_si256((__m256i*)assignment_row, min_assignment_vec);
+                    } else {
+                        ALIGN_SIMD uint32_t calcd_values[8];
+                        _mm256_store_si256((__m256i *)calcd_values, assignment_value_vec);
+                        for (int v = 0; v < patch_virtual_width - j; v++) {
+                            if (assignment_row[v] > calcd_values[v]) {
+                                assignment_row[v] = calcd_values[v];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
 static void slic_assign(Context *context) {
     if (!strcmp(context->algorithm, "cluster_oriented")) {
         slic_assign_cluster_oriented(context);
+    } else if (!strcmp(context->algorithm, "tiled")) {
+        slic_assign_tiled(context);
     }
 }
 
-static void slic_update_clusters(Context *context, bool reset_assignment) {
-    auto H = context->H;
-    auto W = context->W;
-    auto K = context->K;
-    auto aligned_quad_image = context->aligned_quad_image;
+// Member counts and sums of [y, x, r, g, b] of each cluster
+struct ClusterSums {
+    std::vector<int> num_cluster_members;
+    std::vector<int> cluster_acc_vec;
+};
+
+static void update_cluster_centers(Context *context, const int* num_cluster_members, const int* cluster_acc_vec) {
+    const int K = context->K;
     auto clusters = context->clusters;
+    auto dirty_clusters = context->dirty_clusters;
+    for (int k = 0; k < K; k++) {
+        if (dirty_clusters && !dirty_clusters[k]) continue;
+        int num_current_members = num_cluster_members[k];
+        Cluster *cluster = &clusters[k];
+        cluster->num_members = num_current_members;
+
+        if (num_current_members == 0) continue;
+
+        // Technically speaking, as for L1 norm, you need median instead of mean for correct maximization.
+        // But, I intentionally used mean here for the sake of performance.
+        cluster->y = round_int(cluster_acc_vec[5 * k + 0], num_current_members);
+        cluster->x = round_int(cluster_acc_vec[5 * k + 1], num_current_members);
+        cluster->r = round_int(cluster_acc_vec[5 * k + 2], num_current_members);
+        cluster->g = round_int(cluster_acc_vec[5 * k + 3], num_current_members);
+        cluster->b = round_int(cluster_acc_vec[5 * k + 4], num_current_members);
+    }
+}
+
+// sums (optional) receives the statistics the cluster centers were computed from
+static void slic_update_clusters(Context *context, bool reset_assignment, ClusterSums* sums = nullptr) {
+    auto K = context->K;
+    auto aligned_rgb_image = context->aligned_rgb_image;
     auto aligned_assignment = context->aligned_assignment;
-    auto quad_image_memory_width = context->quad_image_memory_width;
+    auto rgb_image_memory_width = context->rgb_image_memory_width;
     auto assignment_memory_width = context->assignment_memory_width;
+    auto changed_tiles = context->changed_tiles;
+    auto dirty_clusters = context->dirty_clusters;
+    auto num_tile_cols = context->num_tile_cols;
+    const int row_step = context->row_step;
+    const bool tiled = !context->tiled_assignment.empty();
+    const uint8_t* tiled_rgb_image = context->tiled_rgb_image.data();
+    uint32_t* tiled_assignment = context->tiled_assignment.data();
+    const int y_lo = context->update_y_lo, y_hi = context->update_y_hi;
+    const int x_lo = context->update_x_lo, x_hi = context->update_x_hi;
+    const uint8_t* aligned_depth = context->aligned_depth;
+    // RGB-D mode: sum of the quantized depth in cluster
+    std::vector<int> cluster_depth_acc(aligned_depth ? K : 0, 0);
+    // Extent mode: the member boxes are only needed when a full assignment follows
+    const bool track_extents = context->extent_margin > 0 && reset_assignment && !changed_tiles && !tiled;
+    const ClusterBox empty_box = {INT16_MAX, INT16_MIN, INT16_MAX, INT16_MIN};
+    context->cluster_extents.assign(track_extents ? K : 0, empty_box);
 
     int *num_cluster_members = new int[K];
     int *cluster_acc_vec = new int[K * 5]; // sum of [y, x, r, g, b] in cluster
@@ -293,26 +614,67 @@ static void slic_update_clusters(Context *context, bool reset_assignment) {
         int *local_num_cluster_members = new int[K];
         std::fill_n(local_num_cluster_members, K, 0);
         std::fill_n(local_acc_vec, K * 5, 0);
+        std::vector<int> local_depth_acc(cluster_depth_acc.size(), 0);
+        std::vector<ClusterBox> local_extents(context->cluster_extents.size(), empty_box);
+
+        // Tiled mode: walk each row tile by tile, the pixels of a tile row being contiguous
+        #pragma omp for
+        for (int i = (tiled ? y_lo : y_hi); i < y_hi; i += row_step) {
+            for (int tile_j = x_lo; tile_j < x_hi; tile_j += 1 << tiled_width_shift) {
+                const size_t tile_row_index = tiled_index(context, i, tile_j);
+                const int tile_j_hi = my_min(x_hi, tile_j + (1 << tiled_width_shift));
+                for (int j = tile_j; j < tile_j_hi; j++) {
+                    const size_t index = tile_row_index + (j - tile_j);
+                    cluster_no_t cluster_no = (cluster_no_t)(tiled_assignment[index] & 0x0000FFFF);
+                    if (reset_assignment) tiled_assignment[index] = 0xFFFFFFFF;
+                    if (cluster_no != 0xFFFF && cluster_no < K) {
+                        local_num_cluster_members[cluster_no]++;
+                        local_acc_vec[5 * cluster_no + 0] += i;
+                        local_acc_vec[5 * cluster_no + 1] += j;
+                        local_acc_vec[5 * cluster_no + 2] += tiled_rgb_image[3 * index];
+                        local_acc_vec[5 * cluster_no + 3] += tiled_rgb_image[3 * index + 1];
+                        local_acc_vec[5 * cluster_no + 4] += tiled_rgb_image[3 * index + 2];
+                    }
+                }
+            }
+        }
 
         #if _OPENMP >= 200805
         #pragma omp for collapse(2)
         #else
         #pragma omp for
         #endif
-        for (int i = 0; i < H; i++) {
-            for (int j = 0; j < W; j++) {
-                int img_base_index = quad_image_memory_width * i + 4 * j;
+        for (int i = (tiled ? y_hi : y_lo); i < y_hi; i += row_step) {
+            for (int j = x_lo; j < x_hi; j++) {
+                int img_base_index = rgb_image_memory_width * i + 3 * j;
                 int assignment_index = assignment_memory_width * i + j;
 
+                const uint8_t* pixel_rgb = aligned_rgb_image + img_base_index;
                 cluster_no_t cluster_no = (cluster_no_t)(aligned_assignment[assignment_index] & 0x0000FFFF);
-                if (reset_assignment) aligned_assignment[assignment_index] = 0xFFFFFFFF;
+                if (changed_tiles) {
+                    // Incremental mode: pixels of unchanged tiles keep their labels, and clean clusters keep their statistics
+                    if (reset_assignment && changed_tiles[(i >> incremental_tile_shift) * num_tile_cols + (j >> incremental_tile_shift)]) {
+                        aligned_assignment[assignment_index] = 0xFFFFFFFF;
+                    }
+                    if (cluster_no < K && !dirty_clusters[cluster_no]) continue;
+                } else if (reset_assignment) {
+                    aligned_assignment[assignment_index] = 0xFFFFFFFF;
+                }
                 if (cluster_no != 0xFFFF && cluster_no < K) {
                     local_num_cluster_members[cluster_no]++;
                     local_acc_vec[5 * cluster_no + 0] += i;
                     local_acc_vec[5 * cluster_no + 1] += j;
-                    local_acc_vec[5 * cluster_no + 2] += aligned_quad_image[img_base_index];
-                    local_acc_vec[5 * cluster_no + 3] += aligned_quad_image[img_base_index + 1];
-                    local_acc_vec[5 * cluster_no + 4] += aligned_quad_image[img_base_index + 2];
+                    local_acc_vec[5 * cluster_no + 2] += pixel_rgb[0];
+                    local_acc_vec[5 * cluster_no + 3] += pixel_rgb[1];
+                    local_acc_vec[5 * cluster_no + 4] += pixel_rgb[2];
+                    if (aligned_depth) local_depth_acc[cluster_no] += aligned_depth[assignment_index];
+                    if (track_extents) {
+                        ClusterBox &box = local_extents[cluster_no];
+                        if (box.y_lo > i) box.y_lo = i;
+                        if (box.y_hi <= i) box.y_hi = i + 1;
+                        if (box.x_lo > j) box.x_lo = j;
+                        if (box.x_hi <= j) box.x_hi = j + 1;
+                    }
                 }
             }
         }
@@ -325,30 +687,1431 @@ static void slic_update_clusters(Context *context, bool reset_assignment) {
                 }
                 num_cluster_members[k] += local_num_cluster_members[k];
             }
+            for (size_t k = 0; k < local_depth_acc.size(); k++) {
+                cluster_depth_acc[k] += local_depth_acc[k];
+            }
+            for (size_t k = 0; k < local_extents.size(); k++) {
+                ClusterBox &box = context->cluster_extents[k];
+                box.y_lo = my_min(box.y_lo, local_extents[k].y_lo);
+                box.y_hi = my_max(box.y_hi, local_extents[k].y_hi);
+                box.x_lo = my_min(box.x_lo, local_extents[k].x_lo);
+                box.x_hi = my_max(box.x_hi, local_extents[k].x_hi);
+            }
         }
 
         delete [] local_num_cluster_members;
         delete [] local_acc_vec;
     }
 
+    if (sums != nullptr) {
+        sums->num_cluster_members.assign(num_cluster_members, num_cluster_members + K);
+        sums->cluster_acc_vec.assign(cluster_acc_vec, cluster_acc_vec + 5 * K);
+    }
+    update_cluster_centers(context, num_cluster_members, cluster_acc_vec);
+    for (size_t k = 0; k < cluster_depth_acc.size(); k++) {
+        if (num_cluster_members[k] > 0) {
+            context->clusters[k].reserved[0] = round_int(cluster_depth_acc[k], num_cluster_members[k]);
+        }
+    }
+    delete [] num_cluster_members;
+    delete [] cluster_acc_vec;
+}
+
+// Moves each cluster of a volume to the mean of its voxels. The sums are kept in 64 bits:
+// a supervoxel easily holds tens of thousands of voxels.
+static void slic_update_clusters_volume(Context *context, bool reset_assignment) {
+    const int D = context->D, H = context->H, W = context->W, K = context->K;
+    const uint8_t* aligned_rgb_image = context->aligned_rgb_image;
+    uint32_t* aligned_assignment = context->aligned_assignment;
+    const int rgb_image_memory_width = context->rgb_image_memory_width;
+    const int assignment_memory_width = context->assignment_memory_width;
+    const int slice_memory_height = context->slice_memory_height;
+
+    std::vector<int64_t> cluster_acc_vec(K * 6, 0); // sum of [z, y, x, r, g, b] in cluster
+    std::vector<int> num_cluster_members(K, 0);
+
+    #pragma omp parallel
+    {
+        std::vector<int64_t> local_acc_vec(K * 6, 0);
+        std::vector<int> local_num_cluster_members(K, 0);
+
+        #pragma omp for
+        for (int zi = 0; zi < D * H; zi++) {
+            const int z = zi / H, i = zi % H;
+            const size_t row = (size_t)z * slice_memory_height + i;
+            const uint8_t* img_row = aligned_rgb_image + rgb_image_memory_width * row;
+            uint32_t* assignment_row = aligned_assignment + assignment_memory_width * row;
+            for (int j = 0; j < W; j++) {
+                cluster_no_t cluster_no = (cluster_no_t)(assignment_row[j] & 0x0000FFFF);
+                if (reset_assignment) assignment_row[j] = 0xFFFFFFFF;
+                if (cluster_no == 0xFFFF || cluster_no >= K) continue;
+                local_num_cluster_members[cluster_no]++;
+                int64_t* acc = &local_acc_vec[6 * cluster_no];
+                acc[0] += z;
+                acc[1] += i;
+                acc[2] += j;
+                acc[3] += img_row[3 * j];
+                acc[4] += img_row[3 * j + 1];
+                acc[5] += img_row[3 * j + 2];
+            }
+        }
+
+        #pragma omp critical
+        {
+            for (int k = 0; k < K; k++) {
+                for (int dim = 0; dim < 6; dim++) {
+                    cluster_acc_vec[6 * k + dim] += local_acc_vec[6 * k + dim];
+                }
+                num_cluster_members[k] += local_num_cluster_members[k];
+            }
+        }
+    }
 
     for (int k = 0; k < K; k++) {
-        int num_current_members = num_cluster_members[k];
-        Cluster *cluster = &clusters[k];
+        const int64_t num_current_members = num_cluster_members[k];
+        Cluster *cluster = &context->clusters[k];
         cluster->num_members = num_current_members;
-
         if (num_current_members == 0) continue;
+        context->cluster_z[k] = round_int(cluster_acc_vec[6 * k + 0], num_current_members);
+        cluster->y = round_int(cluster_acc_vec[6 * k + 1], num_current_members);
+        cluster->x = round_int(cluster_acc_vec[6 * k + 2], num_current_members);
+        cluster->r = round_int(cluster_acc_vec[6 * k + 3], num_current_members);
+        cluster->g = round_int(cluster_acc_vec[6 * k + 4], num_current_members);
+        cluster->b = round_int(cluster_acc_vec[6 * k + 5], num_current_members);
+    }
+}
 
-        // Technically speaking, as for L1 norm, you need median instead of mean for correct maximization.
-        // But, I intentionally used mean here for the sake of performance.
-        cluster->y = round_int(cluster_acc_vec[5 * k + 0], num_current_members);
-        cluster->x = round_int(cluster_acc_vec[5 * k + 1], num_current_members);
-        cluster->r = round_int(cluster_acc_vec[5 * k + 2], num_current_members);
-        cluster->g = round_int(cluster_acc_vec[5 * k + 3], num_current_members);
-        cluster->b = round_int(cluster_acc_vec[5 * k + 4], num_current_members);
+// RGB-D mode: quantizes depth (float[H, W]) to min(255, depth * depth_weight) into the padded depth plane
+// (non-finite and negative depths count as 0) and starts each cluster from the depth at its center.
+static void prepare_depth(Context *context, const float* depth, float depth_weight) {
+    const int H = context->H, W = context->W, S = context->S;
+    const int memory_width = context->assignment_memory_width;
+    // 8 bytes are loaded at a time
+    context->depth_plane.assign((size_t)(H + 2 * S) * memory_width + 8, 0);
+    uint8_t* aligned_depth = &context->depth_plane[(size_t)S * memory_width + S];
+    #pragma omp parallel for
+    for (int i = 0; i < H; i++) {
+        for (int j = 0; j < W; j++) {
+            float value = depth[(size_t)W * i + j] * depth_weight;
+            aligned_depth[(size_t)memory_width * i + j] = (value >= 0) ? (uint8_t)my_min(255.0f, value + 0.5f) : 0;
+        }
+    }
+    context->aligned_depth = aligned_depth;
+    for (int k = 0; k < context->K; k++) {
+        Cluster* cluster = &context->clusters[k];
+        cluster->reserved[0] = aligned_depth[(size_t)memory_width * cluster->y + cluster->x];
     }
-    delete [] num_cluster_members;
-    delete [] cluster_acc_vec;
+}
+
+// Sums absolute differences of packed RGB rows per (1 << incremental_tile_shift)-sized square tile
+// and marks tiles whose mean difference per channel exceeds the threshold.
+static int find_changed_tiles(int H, int W, const uint8_t* prev_image, const uint8_t* image, float threshold, std::vector<uint8_t> &changed_tiles) {
+    const int T = 1 << incremental_tile_shift;
+    const int num_tile_rows = ceil_int(H, T), num_tile_cols = ceil_int(W, T);
+    changed_tiles.assign(num_tile_rows * num_tile_cols, 0);
+    int num_changed = 0;
+
+    #pragma omp parallel for reduction(+:num_changed)
+    for (int ty = 0; ty < num_tile_rows; ty++) {
+        const int i_lo = ty * T, i_hi = my_min(H, i_lo + T);
+        for (int tx = 0; tx < num_tile_cols; tx++) {
+            const int b_lo = 3 * tx * T, b_hi = 3 * my_min(W, (tx + 1) * T);
+            __m256i sad_acc = _mm256_setzero_si256();
+            uint32_t tail_sad = 0;
+            for (int i = i_lo; i < i_hi; i++) {
+                const uint8_t* prev_row = prev_image + (size_t)3 * W * i;
+                const uint8_t* row = image + (size_t)3 * W * i;
+                int b = b_lo;
+                for (; b + 32 <= b_hi; b += 32) {
+                    __m256i prev_segment = _mm256_loadu_si256((const __m256i *)(prev_row + b));
+                    __m256i segment = _mm256_loadu_si256((const __m256i *)(row + b));
+                    sad_acc = _mm256_add_epi64(sad_acc, _mm256_sad_epu8(prev_segment, segment));
+                }
+                for (; b + 16 <= b_hi; b += 16) {
+                    __m128i prev_segment = _mm_loadu_si128((const __m128i *)(prev_row + b));
+                    __m128i segment = _mm_loadu_si128((const __m128i *)(row + b));
+                    sad_acc = _mm256_add_epi64(sad_acc, _mm256_zextsi128_si256(_mm_sad_epu8(prev_segment, segment)));
+                }
+                for (; b < b_hi; b++) {
+                    tail_sad += fast_abs<int>((int)prev_row[b] - (int)row[b]);
+                }
+            }
+            ALIGN_SIMD uint64_t sads[4];
+            _mm256_store_si256((__m256i *)sads, sad_acc);
+            uint64_t tile_sad = sads[0] + sads[1] + sads[2] + sads[3] + tail_sad;
+            if ((float)tile_sad > threshold * (float)((i_hi - i_lo) * (b_hi - b_lo))) {
+                changed_tiles[ty * num_tile_cols + tx] = 1;
+                num_changed++;
+            }
+        }
+    }
+    return num_changed;
+}
+
+// A cluster is dirty if its (2S+1)x(2S+1) window touches a changed tile.
+// Also narrows the update region of the context to the dirty windows plus an S margin,
+// which holds the members of dirty clusters lying outside their current windows.
+static void find_dirty_clusters(Context *context, const std::vector<uint8_t> &changed_tiles, std::vector<uint8_t> &dirty_clusters) {
+    const int H = context->H, W = context->W, K = context->K, S = context->S;
+    const Cluster* clusters = context->clusters;
+    const int T = 1 << incremental_tile_shift;
+    const int num_tile_rows = ceil_int(H, T), num_tile_cols = ceil_int(W, T);
+    std::vector<int> prefix_sum((num_tile_rows + 1) * (num_tile_cols + 1), 0);
+    for (int ty = 0; ty < num_tile_rows; ty++) {
+        for (int tx = 0; tx < num_tile_cols; tx++) {
+            prefix_sum[(ty + 1) * (num_tile_cols + 1) + tx + 1] = changed_tiles[ty * num_tile_cols + tx]
+                + prefix_sum[ty * (num_tile_cols + 1) + tx + 1]
+                + prefix_sum[(ty + 1) * (num_tile_cols + 1) + tx]
+                - prefix_sum[ty * (num_tile_cols + 1) + tx];
+        }
+    }
+
+    dirty_clusters.assign(K, 0);
+    int y_lo = H, y_hi = 0, x_lo = W, x_hi = 0;
+    for (int k = 0; k < K; k++) {
+        const Cluster* cluster = &clusters[k];
+        int ty_lo = my_max(0, cluster->y - S) >> incremental_tile_shift, ty_hi = (my_min(H - 1, cluster->y + S) >> incremental_tile_shift) + 1;
+        int tx_lo = my_max(0, cluster->x - S) >> incremental_tile_shift, tx_hi = (my_min(W - 1, cluster->x + S) >> incremental_tile_shift) + 1;
+        int num_changed = prefix_sum[ty_hi * (num_tile_cols + 1) + tx_hi]
+            - prefix_sum[ty_lo * (num_tile_cols + 1) + tx_hi]
+            - prefix_sum[ty_hi * (num_tile_cols + 1) + tx_lo]
+            + prefix_sum[ty_lo * (num_tile_cols + 1) + tx_lo];
+        dirty_clusters[k] = num_changed > 0;
+        if (dirty_clusters[k]) {
+            y_lo = my_min(y_lo, cluster->y - 2 * S);
+            y_hi = my_max(y_hi, cluster->y + 2 * S + 1);
+            x_lo = my_min(x_lo, cluster->x - 2 * S);
+            x_hi = my_max(x_hi, cluster->x + 2 * S + 1);
+        }
+    }
+    context->update_y_lo = my_max(0, y_lo);
+    context->update_y_hi = my_min(H, y_hi);
+    context->update_x_lo = my_max(0, x_lo);
+    context->update_x_hi = my_min(W, x_hi);
+}
+
+// Enforces connectivity only around the changed tiles: on the rows spanned by the connected components
+// (of equal labels) that lie in or next to the rows of changed tiles, so that none of them is cut by the band edge.
+// The other components crossing that band were already enforced on an earlier frame and are restored afterwards.
+static void slic_enforce_connectivity_changed_rows(Context *context, const std::vector<uint8_t> &changed_tiles) {
+    const int H = context->H, W = context->W;
+    const int T = 1 << incremental_tile_shift;
+    const int num_tile_cols = context->num_tile_cols, num_tile_rows = ceil_int(H, T);
+    int ty_lo = num_tile_rows, ty_hi = -1;
+    for (int ty = 0; ty < num_tile_rows; ty++) {
+        for (int tx = 0; tx < num_tile_cols; tx++) {
+            if (changed_tiles[ty * num_tile_cols + tx]) {
+                ty_lo = my_min(ty_lo, ty);
+                ty_hi = my_max(ty_hi, ty);
+                break;
+            }
+        }
+    }
+    if (ty_hi < 0) return;
+
+    const int core_lo = ty_lo * T, core_hi = my_min(H, (ty_hi + 1) * T);
+    uint32_t* assignment = context->assignment;
+
+    // Flood the components touching the core rows and take the rows they span
+    std::vector<uint8_t> touched((size_t)H * W, 0);
+    std::vector<int> stack;
+    int band_lo = core_lo, band_hi = core_hi;
+    for (int index = my_max(0, core_lo - 1) * W; index < my_min(H, core_hi + 1) * W; index++) {
+        if (touched[index]) continue;
+        touched[index] = 1;
+        stack.push_back(index);
+        while (!stack.empty()) {
+            const int current = stack.back();
+            stack.pop_back();
+            const int i = current / W, j = current % W;
+            band_lo = my_min(band_lo, i);
+            band_hi = my_max(band_hi, i + 1);
+            const uint32_t label = assignment[current];
+            const int neighbors[4] = {
+                (i > 0) ? current - W : -1,
+                (i + 1 < H) ? current + W : -1,
+                (j > 0) ? current - 1 : -1,
+                (j + 1 < W) ? current + 1 : -1,
+            };
+            for (int neighbor : neighbors) {
+                if (neighbor < 0 || touched[neighbor] || assignment[neighbor] != label) continue;
+                touched[neighbor] = 1;
+                stack.push_back(neighbor);
+            }
+        }
+    }
+
+    uint32_t* band_assignment = assignment + (size_t)band_lo * W;
+    const size_t band_size = (size_t)(band_hi - band_lo) * W;
+    std::vector<uint32_t> prev_band(band_assignment, band_assignment + band_size);
+
+    context->H = band_hi - band_lo;
+    context->assignment = band_assignment;
+    slic_enforce_connectivity(context);
+    context->H = H;
+    context->assignment = assignment;
+
+    const uint8_t* band_touched = &touched[(size_t)band_lo * W];
+    for (size_t index = 0; index < band_size; index++) {
+        if (!band_touched[index]) band_assignment[index] = prev_band[index];
+    }
+}
+
+// Overwrites the changed tiles of the reference frame with the current one, whose labels they now hold.
+static void update_reference_tiles(int H, int W, const uint8_t* image, uint8_t* reference, const std::vector<uint8_t> &changed_tiles) {
+    const int T = 1 << incremental_tile_shift;
+    const int num_tile_cols = ceil_int(W, T);
+    #pragma omp parallel for
+    for (int i = 0; i < H; i++) {
+        const uint8_t* tiles = &changed_tiles[(i >> incremental_tile_shift) * num_tile_cols];
+        for (int tx = 0; tx < num_tile_cols; tx++) {
+            if (!tiles[tx]) continue;
+            const size_t offset = (size_t)3 * W * i + 3 * tx * T;
+            std::memcpy(reference + offset, image + offset, 3 * (my_min(W, (tx + 1) * T) - tx * T));
+        }
+    }
+}
+
+// Halves the resolution of a packed RGB image by averaging 2x2 blocks. Odd trailing rows and columns are dropped.
+static void downsample_image_2x(int H, int W, const uint8_t* image, std::vector<uint8_t> &result) {
+    const int h = H / 2, w = W / 2;
+    result.assign((size_t)3 * h * w, 0);
+    // Keeps the first pixel of every 6-byte pair after the horizontal average
+    const __m128i compact_mask = _mm_setr_epi8(0, 1, 2, 6, 7, 8, 12, 13, 14, -1, -1, -1, -1, -1, -1, -1);
+
+    #pragma omp parallel
+    {
+        std::vector<uint8_t> row_avg(6 * w);
+        #pragma omp for
+        for (int i = 0; i < h; i++) {
+            const uint8_t* top = image + (size_t)3 * W * (2 * i);
+            const uint8_t* bottom = top + 3 * W;
+            uint8_t* out = &result[(size_t)3 * w * i];
+            int b = 0;
+            for (; b + 32 <= 6 * w; b += 32) {
+                __m256i avg = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)(top + b)), _mm256_loadu_si256((const __m256i *)(bottom + b)));
+                _mm256_storeu_si256((__m256i *)&row_avg[b], avg);
+            }
+            for (; b < 6 * w; b++) {
+                row_avg[b] = (uint8_t)(((int)top[b] + (int)bottom[b] + 1) >> 1);
+            }
+
+            // Three output pixels per step; each store spills 7 bytes which the next step overwrites
+            int q = 0;
+            for (; 3 * q + 16 <= 3 * w; q += 3) {
+                __m128i left = _mm_loadu_si128((const __m128i *)&row_avg[6 * q]);
+                __m128i right = _mm_loadu_si128((const __m128i *)&row_avg[6 * q + 3]);
+                _mm_storeu_si128((__m128i *)(out + 3 * q), _mm_shuffle_epi8(_mm_avg_epu8(left, right), compact_mask));
+            }
+            for (; q < w; q++) {
+                for (int c = 0; c < 3; c++) {
+                    out[3 * q + c] = (uint8_t)(((int)row_avg[6 * q + c] + (int)row_avg[6 * q + 3 + c] + 1) >> 1);
+                }
+            }
+        }
+    }
+}
+
+static void slic_iterate_avx2(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t *__restrict__ image, Cluster *__restrict__ clusters, uint32_t* __restrict__ assignment, const SlicOptions* options, bool enforce_connectivity);
+
+// Coarse stage of the pyramid mode: runs the iterations on the image downsampled `levels` times,
+// then brings the clusters and the labels back to full resolution. Connectivity is only enforced
+// at full resolution, after the fine iterations.
+static void slic_iterate_coarse(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, int levels, const uint8_t* image, Cluster* clusters, uint32_t* assignment) {
+    std::vector<uint8_t> pyramid[2];
+    const uint8_t* level_image = image;
+    int h = H, w = W;
+    for (int l = 0; l < levels; l++) {
+        downsample_image_2x(h, w, level_image, pyramid[l % 2]);
+        level_image = pyramid[l % 2].data();
+        h /= 2;
+        w /= 2;
+    }
+
+    for (int k = 0; k < K; k++) {
+        clusters[k].y = my_min(clusters[k].y >> levels, h - 1);
+        clusters[k].x = my_min(clusters[k].x >> levels, w - 1);
+    }
+    std::vector<uint32_t> coarse_assignment((size_t)h * w);
+    slic_iterate_avx2(h, w, K, compactness, min_size_factor, quantize_level, max_iter, level_image, clusters, coarse_assignment.data(), nullptr, false);
+
+    const int half_block = (1 << levels) / 2;
+    for (int k = 0; k < K; k++) {
+        clusters[k].y = my_min((clusters[k].y << levels) + half_block, H - 1);
+        clusters[k].x = my_min((clusters[k].x << levels) + half_block, W - 1);
+    }
+    #pragma omp parallel for
+    for (int i = 0; i < H; i++) {
+        const uint32_t* coarse_row = &coarse_assignment[(size_t)w * my_min(i >> levels, h - 1)];
+        for (int j = 0; j < W; j++) {
+            assignment[W * i + j] = coarse_row[my_min(j >> levels, w - 1)];
+        }
+    }
+}
+
+// Boundary band: the band is tracked in row segments of 8 pixels (one SIMD assignment row),
+// and the candidate clusters of a segment are the labels of the 8x8 blocks around it.
+static const int band_block_shift = 3;
+static const int max_block_labels = 8;
+
+struct BoundaryBand {
+    int band_width;
+    int num_block_rows, num_block_cols;
+    // Distinct labels of each 8x8 block; labels beyond max_block_labels are dropped
+    std::vector<uint16_t> block_labels;
+    std::vector<uint8_t> num_block_labels;
+    // [H, num_block_cols]: segments re-evaluated by the next band iteration
+    std::vector<uint8_t> segments;
+    // Running cluster statistics, updated with the pixels that change label
+    ClusterSums sums;
+};
+
+static int collect_block_labels(const Context *context, int by, int bx, uint16_t* labels) {
+    const int H = context->H, W = context->W, K = context->K;
+    const int B = 1 << band_block_shift;
+    const int assignment_memory_width = context->assignment_memory_width;
+    int num_labels = 0;
+    uint16_t last_label = 0xFFFF;
+    for (int i = by * B; i < my_min(H, (by + 1) * B); i++) {
+        for (int j = bx * B; j < my_min(W, (bx + 1) * B); j++) {
+            uint16_t label = context->aligned_assignment[assignment_memory_width * i + j] & 0xFFFF;
+            if (label == last_label || label >= K) continue;
+            last_label = label;
+            if (num_labels < max_block_labels && std::find(labels, labels + num_labels, label) == labels + num_labels) {
+                labels[num_labels++] = label;
+            }
+        }
+    }
+    return num_labels;
+}
+
+// Marks the segments of a row overlapping [j - band_width, j + band_width]
+static inline void mark_segments(uint8_t* segment_row, int W, int j, int band_width) {
+    const int s_lo = my_max(0, j - band_width) >> band_block_shift, s_hi = my_min(W - 1, j + band_width) >> band_block_shift;
+    for (int s = s_lo; s <= s_hi; s++) segment_row[s] = 1;
+}
+
+// Grows the marked segments by band_width rows. Returns the number of marked segments.
+static int dilate_segments_vertically(int H, int num_segment_cols, int band_width, const std::vector<uint8_t> &marks, std::vector<uint8_t> &segments) {
+    segments.assign((size_t)H * num_segment_cols, 0);
+    int num_segments = 0;
+    #pragma omp parallel for reduction(+:num_segments)
+    for (int i = 0; i < H; i++) {
+        uint8_t* segment_row = &segments[(size_t)num_segment_cols * i];
+        for (int r = my_max(0, i - band_width); r <= my_min(H - 1, i + band_width); r++) {
+            const uint8_t* mark_row = &marks[(size_t)num_segment_cols * r];
+            for (int s = 0; s < num_segment_cols; s++) segment_row[s] |= mark_row[s];
+        }
+        for (int s = 0; s < num_segment_cols; s++) num_segments += segment_row[s];
+    }
+    return num_segments;
+}
+
+// Starts the band on the segments within band_width of a label boundary. Returns the number of band segments.
+static int init_boundary_band(const Context *context, int band_width, BoundaryBand &band) {
+    const int H = context->H, W = context->W;
+    const int B = 1 << band_block_shift;
+    const int num_block_rows = band.num_block_rows = ceil_int(H, B);
+    const int num_block_cols = band.num_block_cols = ceil_int(W, B);
+    const int num_blocks = num_block_rows * num_block_cols;
+    const int assignment_memory_width = context->assignment_memory_width;
+    const uint32_t* aligned_assignment = context->aligned_assignment;
+    band.band_width = band_width;
+    band.block_labels.assign((size_t)num_blocks * max_block_labels, 0xFFFF);
+    band.num_block_labels.assign(num_blocks, 0);
+
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        band.num_block_labels[block] = collect_block_labels(context, block / num_block_cols, block % num_block_cols, &band.block_labels[(size_t)block * max_block_labels]);
+    }
+
+    std::vector<uint8_t> marks((size_t)H * num_block_cols, 0);
+    const __m256i label_mask = _mm256_set1_epi32(0xFFFF);
+    #pragma omp parallel for
+    for (int i = 0; i < H; i++) {
+        const uint32_t* row = aligned_assignment + assignment_memory_width * i;
+        const uint32_t* upper_row = (i > 0) ? row - assignment_memory_width : row;
+        const uint32_t* lower_row = (i + 1 < H) ? row + assignment_memory_width : row;
+        uint8_t* mark_row = &marks[(size_t)num_block_cols * i];
+        int j = 0;
+        // A pixel lies on a boundary if its label differs from one of its 4-neighbors
+        for (; j + 9 <= W; j += 8) {
+            __m256i label = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(row + j)), label_mask);
+            __m256i same = _mm256_cmpeq_epi32(label, _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(row + j + 1)), label_mask));
+            if (j > 0) {
+                same = _mm256_and_si256(same, _mm256_cmpeq_epi32(label, _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(row + j - 1)), label_mask)));
+            }
+            same = _mm256_and_si256(same, _mm256_cmpeq_epi32(label, _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(upper_row + j)), label_mask)));
+            same = _mm256_and_si256(same, _mm256_cmpeq_epi32(label, _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(lower_row + j)), label_mask)));
+            int boundary_bits = ~_mm256_movemask_ps(_mm256_castsi256_ps(same)) & 0xFF;
+            while (boundary_bits) {
+                int v = __builtin_ctz(boundary_bits);
+                boundary_bits &= boundary_bits - 1;
+                mark_segments(mark_row, W, j + v, band_width);
+            }
+        }
+        for (; j < W; j++) {
+            uint16_t label = row[j] & 0xFFFF;
+            if ((j > 0 && label != (row[j - 1] & 0xFFFF)) || (j + 1 < W && label != (row[j + 1] & 0xFFFF))
+                    || label != (upper_row[j] & 0xFFFF) || label != (lower_row[j] & 0xFFFF)) {
+                mark_segments(mark_row, W, j, band_width);
+            }
+        }
+    }
+    return dilate_segments_vertically(H, num_block_cols, band_width, marks, band.segments);
+}
+
+// Re-evaluates the band segments against the clusters found in the 8x8 blocks around them, with the
+// same packed min-assignment as the cluster-oriented kernel. The cluster statistics follow the pixels
+// that changed label, and the band moves to the segments within band_width of those pixels.
+// Returns the number of band segments for the next iteration.
+static int slic_assign_band(Context *context, BoundaryBand &band) {
+    const int H = context->H, W = context->W, K = context->K, S = context->S;
+    const uint8_t quantize_level = context->quantize_level;
+    const Cluster* clusters = context->clusters;
+    const uint8_t* __restrict__ aligned_rgb_image = context->aligned_rgb_image;
+    const uint16_t* __restrict__ spatial_dist_patch = context->spatial_dist_patch;
+    uint32_t* __restrict__ aligned_assignment = context->aligned_assignment;
+    const int rgb_image_memory_width = context->rgb_image_memory_width;
+    const int assignment_memory_width = context->assignment_memory_width;
+    const int patch_virtual_width = 2 * S + 1;
+    const int patch_memory_width = simd_helper::align_to_next(patch_virtual_width);
+    const int B = 1 << band_block_shift;
+    const int num_block_rows = band.num_block_rows, num_block_cols = band.num_block_cols;
+    const int num_blocks = num_block_rows * num_block_cols;
+    const int band_width = band.band_width;
+
+    std::vector<uint8_t> marks((size_t)H * num_block_cols, 0);
+    // Labels that moved into each block; they are added to the block labels after the loop
+    std::vector<uint16_t> new_block_labels((size_t)num_blocks * max_block_labels);
+    std::vector<uint8_t> num_new_block_labels(num_blocks, 0);
+    const __m256i label_mask = _mm256_set1_epi32(0xFFFF);
+
+
+    #pragma omp parallel
+    {
+        std::vector<int> local_num_cluster_members, local_acc_vec;
+        // Marks spill over into the neighboring blocks of other threads, so each thread keeps its own
+        std::vector<uint8_t> local_marks;
+        // Last block that took each cluster as a candidate
+        std::vector<int> candidate_block(K, -1);
+
+        #pragma omp for schedule(dynamic, 16)
+        for (int block = 0; block < num_blocks; block++) {
+            const int by = block / num_block_cols, bx = block % num_block_cols;
+            const int i_lo = by * B, i_hi = my_min(H, i_lo + B);
+            const int j_lo = bx * B, j_hi = my_min(W, j_lo + B);
+            bool any_segment = false;
+            for (int i = i_lo; i < i_hi; i++) any_segment |= band.segments[(size_t)num_block_cols * i + bx] != 0;
+            if (!any_segment) continue;
+
+            // Block labels are only rewritten after this loop, so the candidates do not depend on the block order
+            uint16_t candidates[9 * max_block_labels];
+            int num_candidates = 0;
+            for (int ny = my_max(0, by - 1); ny <= my_min(num_block_rows - 1, by + 1); ny++) {
+                for (int nx = my_max(0, bx - 1); nx <= my_min(num_block_cols - 1, bx + 1); nx++) {
+                    const int neighbor = ny * num_block_cols + nx;
+                    for (int l = 0; l < band.num_block_labels[neighbor]; l++) {
+                        uint16_t label = band.block_labels[(size_t)neighbor * max_block_labels + l];
+                        if (candidate_block[label] != block) {
+                            candidate_block[label] = block;
+                            candidates[num_candidates++] = label;
+                        }
+                    }
+                }
+            }
+
+            uint8_t active_rows[1 << band_block_shift];
+            uint32_t old_values[1 << (2 * band_block_shift)];
+            for (int i = i_lo; i < i_hi; i++) {
+                active_rows[i - i_lo] = band.segments[(size_t)num_block_cols * i + bx];
+                if (!active_rows[i - i_lo]) continue;
+                uint32_t* assignment_row = aligned_assignment + assignment_memory_width * i + j_lo;
+                std::memcpy(&old_values[(i - i_lo) * B], assignment_row, sizeof(uint32_t) * (j_hi - j_lo));
+                std::fill_n(assignment_row, j_hi - j_lo, 0xFFFFFFFF);
+            }
+
+            for (int c = 0; c < num_candidates; c++) {
+                const Cluster* cluster = &clusters[candidates[c]];
+                const int row_lo = my_max(i_lo, cluster->y - S), row_hi = my_min(i_hi, cluster->y + S + 1);
+                if (row_lo >= row_hi) continue;
+                const int patch_x = j_lo - cluster->x + S;
+                const bool full_row = j_hi - j_lo == 8 && patch_x >= 0 && patch_x + 8 <= patch_virtual_width;
+                const uint32_t cluster_color_quad = ((uint32_t)cluster->b << 16) + ((uint32_t)cluster->g << 8) + ((uint32_t)cluster->r);
+                __m256i cluster_color_vec64 = _mm256_set1_epi64x((uint64_t)cluster_color_quad);
+                __m256i cluster_color_vec = _mm256_set1_epi32((uint32_t)cluster_color_quad);
+                __m256i cluster_number_vec = _mm256_set1_epi32((uint32_t)cluster->number);
+
+                for (int i = row_lo; i < row_hi; i++) {
+                    if (!active_rows[i - i_lo]) continue;
+                    const int patch_y = i - cluster->y + S;
+                    const uint8_t* img_rgb_row = aligned_rgb_image + rgb_image_memory_width * i + 3 * j_lo;
+                    uint32_t* assignment_row = aligned_assignment + assignment_memory_width * i + j_lo;
+                    if (full_row) {
+                        ALIGN_SIMD uint16_t spatial_dist_patch_row[8];
+                        std::memcpy(spatial_dist_patch_row, spatial_dist_patch + patch_memory_width * patch_y + patch_x, sizeof(spatial_dist_patch_row));
+                        __m256i assignment_value_vec = get_assignment_value_vec(
+                            cluster, quantize_level, spatial_dist_patch, patch_memory_width,
+                            patch_y, patch_x, patch_virtual_width, img_rgb_row, spatial_dist_patch_row,
+                            cluster_number_vec, cluster_color_vec64, cluster_color_vec
+                        );
+                        __m256i min_assignment_vec = _mm256_min_epu32(_mm256_loadu_si256((__m256i*)assignment_row), assignment_value_vec);
+                        _mm256_storeu_si256((__m256i*)assignment_row, min_assignment_vec);
+                        continue;
+                    }
+                    // Partial rows at the window or image edges
+                    for (int v = 0; v < j_hi - j_lo; v++) {
+                        if (patch_x + v < 0 || patch_x + v >= patch_virtual_width) continue;
+                        uint32_t color_dist = (uint32_t)(fast_abs<int>((int)img_rgb_row[3 * v] - (int)cluster->r)
+                            + fast_abs<int>((int)img_rgb_row[3 * v + 1] - (int)cluster->g)
+                            + fast_abs<int>((int)img_rgb_row[3 * v + 2] - (int)cluster->b)) << quantize_level;
+                        uint32_t dist = my_min<uint32_t>(0xFFFF, spatial_dist_patch[patch_memory_width * patch_y + patch_x + v] + color_dist);
+                        assignment_row[v] = my_min<uint32_t>(assignment_row[v], (dist << 16) | cluster->number);
+                    }
+                }
+            }
+
+            const uint16_t* labels = &band.block_labels[(size_t)block * max_block_labels];
+            uint16_t* new_labels = &new_block_labels[(size_t)block * max_block_labels];
+            for (int i = i_lo; i < i_hi; i++) {
+                if (!active_rows[i - i_lo]) continue;
+                uint32_t* assignment_row = aligned_assignment + assignment_memory_width * i + j_lo;
+                const uint8_t* img_rgb_row = aligned_rgb_image + rgb_image_memory_width * i + 3 * j_lo;
+                const uint32_t* old_row = &old_values[(i - i_lo) * B];
+                if (j_hi - j_lo == 8) {
+                    // Most rows keep all their labels
+                    __m256i value_vec = _mm256_loadu_si256((const __m256i *)assignment_row);
+                    __m256i old_value_vec = _mm256_loadu_si256((const __m256i *)old_row);
+                    value_vec = _mm256_blendv_epi8(value_vec, old_value_vec, _mm256_cmpeq_epi32(value_vec, _mm256_set1_epi32(-1)));
+                    _mm256_storeu_si256((__m256i *)assignment_row, value_vec);
+                    __m256i same_label = _mm256_cmpeq_epi32(_mm256_and_si256(value_vec, label_mask), _mm256_and_si256(old_value_vec, label_mask));
+                    if (_mm256_movemask_ps(_mm256_castsi256_ps(same_label)) == 0xFF) continue;
+                }
+                for (int v = 0; v < j_hi - j_lo; v++) {
+                    if (assignment_row[v] == 0xFFFFFFFF) {
+                        // No candidate window covers the pixel
+                        assignment_row[v] = old_row[v];
+                        continue;
+                    }
+                    const uint16_t label = assignment_row[v] & 0xFFFF, old_label = old_row[v] & 0xFFFF;
+                    if (label == old_label) continue;
+                    if (std::find(labels, labels + band.num_block_labels[block], label) == labels + band.num_block_labels[block]
+                            && std::find(new_labels, new_labels + num_new_block_labels[block], label) == new_labels + num_new_block_labels[block]
+                            && num_new_block_labels[block] < max_block_labels) {
+                        new_labels[num_new_block_labels[block]++] = label;
+                    }
+                    if (local_marks.empty()) local_marks.assign((size_t)H * num_block_cols, 0);
+                    mark_segments(&local_marks[(size_t)num_block_cols * i], W, j_lo + v, band_width);
+                    if (local_num_cluster_members.empty()) {
+                        local_num_cluster_members.assign(K, 0);
+                        local_acc_vec.assign(5 * K, 0);
+                    }
+                    const int pixel_vec[5] = { i, j_lo + v, img_rgb_row[3 * v], img_rgb_row[3 * v + 1], img_rgb_row[3 * v + 2] };
+                    if (old_label < K) {
+                        local_num_cluster_members[old_label]--;
+                        for (int dim = 0; dim < 5; dim++) local_acc_vec[5 * old_label + dim] -= pixel_vec[dim];
+                    }
+                    local_num_cluster_members[label]++;
+                    for (int dim = 0; dim < 5; dim++) local_acc_vec[5 * label + dim] += pixel_vec[dim];
+                }
+            }
+        }
+
+        if (!local_num_cluster_members.empty()) {
+            #pragma omp critical
+            {
+                for (int k = 0; k < K; k++) {
+                    band.sums.num_cluster_members[k] += local_num_cluster_members[k];
+                    for (int dim = 0; dim < 5; dim++) {
+                        band.sums.cluster_acc_vec[5 * k + dim] += local_acc_vec[5 * k + dim];
+                    }
+                }
+            }
+        }
+        if (!local_marks.empty()) {
+            #pragma omp critical
+            {
+                for (size_t s = 0; s < marks.size(); s++) marks[s] |= local_marks[s];
+            }
+        }
+    }
+
+    // Labels that left a block are kept as candidates; they only cost a few extra evaluations
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        uint16_t* labels = &band.block_labels[(size_t)block * max_block_labels];
+        for (int l = 0; l < num_new_block_labels[block] && band.num_block_labels[block] < max_block_labels; l++) {
+            labels[band.num_block_labels[block]++] = new_block_labels[(size_t)block * max_block_labels + l];
+        }
+    }
+    return dilate_segments_vertically(H, num_block_cols, band_width, marks, band.segments);
+}
+
+// Distance bounds (Hamerly-style pruning): each 8-pixel row of an 8x8 block keeps an upper bound of the distance
+// of its pixels to their clusters and a lower bound of their distance to every other cluster covering them.
+// When the clusters move, the bounds are loosened by how much the distance to a cluster can have changed:
+//   |d_new(p, k) - d_old(p, k)| <= drift(k) = spatial(|dy| + |dx|) + (|dr| + |dg| + |db|) << quantize_level.
+// A cluster whose window newly covers a pixel is at least S + 1 - max(|dy|, |dx|) away from it in manhattan distance.
+// A row whose upper bound stays below its lower bound keeps its labels without being evaluated;
+// the others are evaluated against all clusters whose windows cover them, which restores exact bounds.
+struct DistanceBounds {
+    int num_block_rows, num_block_cols;
+    // [H, num_block_cols]: upper and lower bound of each row segment
+    std::vector<uint16_t> upper, lower;
+    // Clusters whose windows cover each 8x8 block, in CSR layout
+    std::vector<int> block_cluster_offsets;
+    std::vector<uint16_t> block_clusters;
+    // Largest drift of the clusters covering each block
+    std::vector<uint16_t> block_max_drift;
+    // Lower bound of the distance to the clusters whose windows moved onto each block (0xFFFF if none)
+    std::vector<uint16_t> block_entering_bound;
+    // Blocks that a window edge left; the owner of each pixel is checked to still cover it
+    std::vector<uint8_t> block_window_left;
+    // [K + 1]: drift and center of each cluster (the last entry stands for "no cluster")
+    std::vector<uint32_t> drift;
+    std::vector<int> center_y, center_x;
+    std::vector<Cluster> prev_clusters;
+    // Spatial distance patch padded by build_padded_patch
+    int padded_patch_width;
+    std::vector<uint16_t> padded_patch;
+    // Running cluster statistics, updated with the pixels that change label
+    ClusterSums sums;
+};
+
+// Computes the cluster drifts and the clusters covering each block
+static void prepare_distance_bounds(const Context *context, DistanceBounds &bounds) {
+    const int H = context->H, W = context->W, K = context->K, S = context->S;
+    const Cluster* clusters = context->clusters;
+    const int B = 1 << band_block_shift;
+    const int num_block_rows = bounds.num_block_rows = ceil_int(H, B);
+    const int num_block_cols = bounds.num_block_cols = ceil_int(W, B);
+    const int num_blocks = num_block_rows * num_block_cols;
+    const bool first = bounds.prev_clusters.empty();
+    if (first) {
+        bounds.upper.assign((size_t)H * num_block_cols, 0xFFFF);
+        bounds.lower.assign((size_t)H * num_block_cols, 0);
+        bounds.padded_patch_width = build_padded_patch(context, bounds.padded_patch);
+    }
+
+    // Largest change of the spatial term when the manhattan distance changes by d
+    const uint16_t* spatial_normalize_cache = context->spatial_normalize_cache;
+    std::vector<uint32_t> spatial_drift(2 * S + 1, 0);
+    for (int d = 1; d <= 2 * S; d++) {
+        for (int x = 0; x + d <= 2 * S; x++) {
+            spatial_drift[d] = my_max<uint32_t>(spatial_drift[d], spatial_normalize_cache[x + d] - spatial_normalize_cache[x]);
+        }
+    }
+
+    bounds.drift.assign(K + 1, 0xFFFF);
+    bounds.center_y.assign(K + 1, -(1 << 20));
+    bounds.center_x.assign(K + 1, -(1 << 20));
+    bounds.block_entering_bound.assign(num_blocks, 0xFFFF);
+    bounds.block_window_left.assign(num_blocks, 0);
+    for (int k = 0; k < K; k++) {
+        const Cluster &cluster = clusters[k];
+        bounds.center_y[k] = cluster.y;
+        bounds.center_x[k] = cluster.x;
+        if (first) continue;
+        const Cluster &prev = bounds.prev_clusters[k];
+        const int dy = fast_abs<int>((int)cluster.y - (int)prev.y), dx = fast_abs<int>((int)cluster.x - (int)prev.x);
+        const int color_drift = fast_abs<int>((int)cluster.r - (int)prev.r) + fast_abs<int>((int)cluster.g - (int)prev.g) + fast_abs<int>((int)cluster.b - (int)prev.b);
+        bounds.drift[k] = my_min<uint32_t>(0xFFFF, spatial_drift[my_min(dy + dx, 2 * S)] + ((uint32_t)color_drift << context->quantize_level));
+        if (dy == 0 && dx == 0) continue;
+        // Blocks crossed by the edge of the old or the new window
+        const uint16_t entering_bound = spatial_normalize_cache[my_max(0, S + 1 - my_max(dy, dx))];
+        const int in_y_lo = my_max(cluster.y, prev.y) - S, in_y_hi = my_min(cluster.y, prev.y) + S + 1;
+        const int in_x_lo = my_max(cluster.x, prev.x) - S, in_x_hi = my_min(cluster.x, prev.x) + S + 1;
+        const int by_lo = my_max(0, my_min(cluster.y, prev.y) - S) >> band_block_shift;
+        const int by_hi = my_min(H - 1, my_max(cluster.y, prev.y) + S) >> band_block_shift;
+        const int bx_lo = my_max(0, my_min(cluster.x, prev.x) - S) >> band_block_shift;
+        const int bx_hi = my_min(W - 1, my_max(cluster.x, prev.x) + S) >> band_block_shift;
+        for (int by = by_lo; by <= by_hi; by++) {
+            const bool rows_inside = by * B >= in_y_lo && my_min(H, (by + 1) * B) <= in_y_hi;
+            for (int bx = bx_lo; bx <= bx_hi; bx++) {
+                if (rows_inside && bx * B >= in_x_lo && my_min(W, (bx + 1) * B) <= in_x_hi) continue;
+                const int block = by * num_block_cols + bx;
+                bounds.block_entering_bound[block] = my_min(bounds.block_entering_bound[block], entering_bound);
+                bounds.block_window_left[block] = 1;
+            }
+        }
+    }
+
+    std::vector<int> &offsets = bounds.block_cluster_offsets;
+    offsets.assign(num_blocks + 1, 0);
+    std::vector<int> fill;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            for (int block = 0; block < num_blocks; block++) offsets[block + 1] += offsets[block];
+            bounds.block_clusters.resize(offsets[num_blocks]);
+            bounds.block_max_drift.assign(num_blocks, 0);
+            fill.assign(num_blocks, 0);
+        }
+        for (int k = 0; k < K; k++) {
+            const Cluster &cluster = clusters[k];
+            const int by_lo = my_max(0, cluster.y - S) >> band_block_shift, by_hi = my_min(H - 1, cluster.y + S) >> band_block_shift;
+            const int bx_lo = my_max(0, cluster.x - S) >> band_block_shift, bx_hi = my_min(W - 1, cluster.x + S) >> band_block_shift;
+            for (int by = by_lo; by <= by_hi; by++) {
+                for (int bx = bx_lo; bx <= bx_hi; bx++) {
+                    const int block = by * num_block_cols + bx;
+                    if (pass == 0) {
+                        offsets[block + 1]++;
+                    } else {
+                        bounds.block_clusters[offsets[block] + fill[block]++] = k;
+                        bounds.block_max_drift[block] = my_max<uint16_t>(bounds.block_max_drift[block], bounds.drift[k]);
+                    }
+                }
+            }
+        }
+    }
+    bounds.prev_clusters.assign(clusters, clusters + K);
+}
+
+// Assigns the rows whose bounds no longer separate the owner from the other clusters. The cluster statistics
+// follow the pixels that changed label. Returns the number of evaluated rows.
+static int slic_assign_bounded(Context *context, DistanceBounds &bounds) {
+    const int H = context->H, W = context->W, K = context->K, S = context->S;
+    const uint8_t quantize_level = context->quantize_level;
+    const Cluster* clusters = context->clusters;
+    const uint8_t* __restrict__ aligned_rgb_image = context->aligned_rgb_image;
+    const uint16_t* __restrict__ spatial_dist_patch = context->spatial_dist_patch;
+    uint32_t* __restrict__ aligned_assignment = context->aligned_assignment;
+    const int rgb_image_memory_width = context->rgb_image_memory_width;
+    const int assignment_memory_width = context->assignment_memory_width;
+    const int patch_virtual_width = 2 * S + 1;
+    const int patch_memory_width = simd_helper::align_to_next(patch_virtual_width);
+    const int B = 1 << band_block_shift;
+
+    prepare_distance_bounds(context, bounds);
+    const int num_block_cols = bounds.num_block_cols;
+    const int num_blocks = bounds.num_block_rows * num_block_cols;
+    const int* center_y = bounds.center_y.data();
+    const int* center_x = bounds.center_x.data();
+    const uint16_t* padded_patch = bounds.padded_patch.data();
+    const int padded_patch_width = bounds.padded_patch_width;
+
+    const __m256i label_mask = _mm256_set1_epi32(0xFFFF);
+    const __m256i max_dist_vec = _mm256_set1_epi32(0xFFFF);
+    const __m256i lane_offsets = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+    int num_evaluated_rows = 0;
+    #pragma omp parallel reduction(+:num_evaluated_rows)
+    {
+        std::vector<int> local_num_cluster_members, local_acc_vec;
+
+        #pragma omp for schedule(dynamic, 16)
+        for (int block = 0; block < num_blocks; block++) {
+            const int by = block / num_block_cols, bx = block % num_block_cols;
+            const int i_lo = by * B, i_hi = my_min(H, i_lo + B);
+            const int j_lo = bx * B, j_hi = my_min(W, j_lo + B);
+            const int num_lanes = j_hi - j_lo;
+            const uint16_t max_drift = bounds.block_max_drift[block];
+            const uint16_t entering_bound = bounds.block_entering_bound[block];
+            const bool window_left = bounds.block_window_left[block] != 0;
+
+            // Loosen the bounds by the drifts and keep the rows where they still separate
+            uint8_t active_rows[1 << band_block_shift];
+            int num_active_rows = 0;
+            for (int i = i_lo; i < i_hi; i++) {
+                const size_t segment = (size_t)num_block_cols * i + bx;
+                const uint32_t upper = my_min<uint32_t>(0xFFFF, bounds.upper[segment] + max_drift);
+                const uint32_t lower = my_min<uint32_t>(bounds.lower[segment] > max_drift ? bounds.lower[segment] - max_drift : 0, entering_bound);
+                bool stable = upper < lower;
+                if (stable && window_left) {
+                    // The owners' windows have to cover the pixels still
+                    const uint32_t* assignment_row = aligned_assignment + assignment_memory_width * i + j_lo;
+                    for (int v = 0; v < num_lanes && stable; v++) {
+                        const uint32_t label = my_min<uint32_t>(assignment_row[v] & 0xFFFF, K);
+                        stable = fast_abs<int>(i - center_y[label]) <= S && fast_abs<int>(j_lo + v - center_x[label]) <= S;
+                    }
+                }
+                if (stable) {
+                    bounds.upper[segment] = upper;
+                    bounds.lower[segment] = lower;
+                }
+                active_rows[i - i_lo] = !stable;
+                num_active_rows += !stable;
+            }
+            if (num_active_rows == 0) continue;
+            num_evaluated_rows += num_active_rows;
+
+            // Evaluate the other rows against every cluster covering the block, keeping the best and the second best distance
+            __m256i best_vecs[1 << band_block_shift], second_vecs[1 << band_block_shift];
+            for (int r = 0; r < i_hi - i_lo; r++) {
+                best_vecs[r] = _mm256_set1_epi32(-1);
+                second_vecs[r] = max_dist_vec;
+            }
+            const uint16_t* candidates = &bounds.block_clusters[bounds.block_cluster_offsets[block]];
+            const int num_candidates = bounds.block_cluster_offsets[block + 1] - bounds.block_cluster_offsets[block];
+            for (int c = 0; c < num_candidates; c++) {
+                const Cluster* cluster = &clusters[candidates[c]];
+                const int row_lo = my_max(i_lo, cluster->y - S), row_hi = my_min(i_hi, cluster->y + S + 1);
+                const int patch_x = j_lo - cluster->x + S;
+                const uint32_t cluster_color_quad = ((uint32_t)cluster->b << 16) + ((uint32_t)cluster->g << 8) + ((uint32_t)cluster->r);
+                __m256i cluster_color_vec64 = _mm256_set1_epi64x((uint64_t)cluster_color_quad);
+                __m256i cluster_color_vec = _mm256_set1_epi32((uint32_t)cluster_color_quad);
+                __m256i cluster_number_vec = _mm256_set1_epi32((uint32_t)cluster->number);
+                // Lanes outside the window (or the image) take no part
+                const int lane_lo = my_max(0, -patch_x), lane_hi = my_min(num_lanes, patch_virtual_width - patch_x);
+                const __m256i outside_vec = _mm256_or_si256(
+                    _mm256_cmpgt_epi32(_mm256_set1_epi32(lane_lo), lane_offsets),
+                    _mm256_cmpgt_epi32(lane_offsets, _mm256_set1_epi32(lane_hi - 1))
+                );
+
+                for (int i = row_lo; i < row_hi; i++) {
+                    if (!active_rows[i - i_lo]) continue;
+                    const int patch_y = i - cluster->y + S;
+                    ALIGN_SIMD uint16_t spatial_dist_patch_row[8];
+                    std::memcpy(spatial_dist_patch_row, &padded_patch[padded_patch_width * patch_y + 8 + patch_x], sizeof(spatial_dist_patch_row));
+                    const uint8_t* img_rgb_row = aligned_rgb_image + rgb_image_memory_width * i + 3 * j_lo;
+                    __m256i value_vec = get_assignment_value_vec(
+                        cluster, quantize_level, spatial_dist_patch, patch_memory_width,
+                        patch_y, patch_x, patch_virtual_width, img_rgb_row, spatial_dist_patch_row,
+                        cluster_number_vec, cluster_color_vec64, cluster_color_vec
+                    );
+                    value_vec = _mm256_or_si256(value_vec, outside_vec);
+                    __m256i &best_vec = best_vecs[i - i_lo], &second_vec = second_vecs[i - i_lo];
+                    second_vec = _mm256_min_epu32(second_vec, _mm256_srli_epi32(_mm256_max_epu32(best_vec, value_vec), 16));
+                    best_vec = _mm256_min_epu32(best_vec, value_vec);
+                }
+            }
+
+            for (int i = i_lo; i < i_hi; i++) {
+                if (!active_rows[i - i_lo]) continue;
+                uint32_t* assignment_row = aligned_assignment + assignment_memory_width * i + j_lo;
+                const uint8_t* img_rgb_row = aligned_rgb_image + rgb_image_memory_width * i + 3 * j_lo;
+                const size_t segment = (size_t)num_block_cols * i + bx;
+                ALIGN_SIMD uint32_t best[8], second[8];
+                _mm256_store_si256((__m256i *)best, best_vecs[i - i_lo]);
+                _mm256_store_si256((__m256i *)second, second_vecs[i - i_lo]);
+                uint32_t upper = 0, lower = 0xFFFF;
+                for (int v = 0; v < num_lanes; v++) {
+                    upper = my_max(upper, best[v] >> 16);
+                    lower = my_min(lower, second[v]);
+                }
+                bounds.upper[segment] = upper;
+                bounds.lower[segment] = lower;
+                if (num_lanes == 8) {
+                    // Most rows keep all their labels
+                    __m256i value_vec = _mm256_loadu_si256((const __m256i *)assignment_row);
+                    _mm256_storeu_si256((__m256i *)assignment_row, best_vecs[i - i_lo]);
+                    __m256i same_label = _mm256_cmpeq_epi32(_mm256_and_si256(value_vec, label_mask), _mm256_and_si256(best_vecs[i - i_lo], label_mask));
+                    if (_mm256_movemask_ps(_mm256_castsi256_ps(same_label)) == 0xFF) continue;
+                    _mm256_storeu_si256((__m256i *)best, value_vec);
+                } else {
+                    for (int v = 0; v < num_lanes; v++) std::swap(assignment_row[v], best[v]);
+                }
+                for (int v = 0; v < num_lanes; v++) {
+                    // best holds the previous values now
+                    const uint16_t label = assignment_row[v] & 0xFFFF, old_label = best[v] & 0xFFFF;
+                    if (label == old_label) continue;
+                    if (local_num_cluster_members.empty()) {
+                        local_num_cluster_members.assign(K, 0);
+                        local_acc_vec.assign(5 * K, 0);
+                    }
+                    const int pixel_vec[5] = { i, j_lo + v, img_rgb_row[3 * v], img_rgb_row[3 * v + 1], img_rgb_row[3 * v + 2] };
+                    if (old_label < K) {
+                        local_num_cluster_members[old_label]--;
+                        for (int dim = 0; dim < 5; dim++) local_acc_vec[5 * old_label + dim] -= pixel_vec[dim];
+                    }
+                    if (label < K) {
+                        local_num_cluster_members[label]++;
+                        for (int dim = 0; dim < 5; dim++) local_acc_vec[5 * label + dim] += pixel_vec[dim];
+                    }
+                }
+            }
+        }
+
+        if (!local_num_cluster_members.empty()) {
+            #pragma omp critical
+            {
+                for (int k = 0; k < K; k++) {
+                    bounds.sums.num_cluster_members[k] += local_num_cluster_members[k];
+                    for (int dim = 0; dim < 5; dim++) {
+                        bounds.sums.cluster_acc_vec[5 * k + dim] += local_acc_vec[5 * k + dim];
+                    }
+                }
+            }
+        }
+    }
+    return num_evaluated_rows;
+}
+
+// SEEDS (Van den Bergh et al. SEEDS: Superpixels Extracted via Energy-Driven Sampling. 2012), on two levels.
+// A regular grid of superpixels is refined by moving blocks of about S/4 pixels between neighboring superpixels
+// when their color histogram intersects better with the neighbor's, then by moving single pixels.
+// Histograms have 4 levels per channel, i.e. 64 float bins, so an intersection is 8 AVX2 min/add steps.
+static const int seeds_num_bins = 64;
+
+static inline int seeds_bin(const uint8_t* rgb) {
+    return ((rgb[0] >> 6) << 4) | ((rgb[1] >> 6) << 2) | (rgb[2] >> 6);
+}
+
+// Intersection of the normalized histograms of a block and a superpixel, leaving the block out of the superpixel
+// if it belongs to it
+static inline float seeds_intersection(const float* block, float block_size, const float* superpixel, float superpixel_size, bool contains_block) {
+    if (contains_block) superpixel_size -= block_size;
+    if (superpixel_size <= 0) return 0;
+    const __m256 block_scale = _mm256_set1_ps(1.0f / block_size), superpixel_scale = _mm256_set1_ps(1.0f / superpixel_size);
+    __m256 acc = _mm256_setzero_ps();
+    for (int i = 0; i < seeds_num_bins; i += 8) {
+        __m256 block_vec = _mm256_loadu_ps(block + i);
+        __m256 superpixel_vec = _mm256_loadu_ps(superpixel + i);
+        if (contains_block) superpixel_vec = _mm256_sub_ps(superpixel_vec, block_vec);
+        acc = _mm256_add_ps(acc, _mm256_min_ps(_mm256_mul_ps(block_vec, block_scale), _mm256_mul_ps(superpixel_vec, superpixel_scale)));
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+// Whether the cell (y, x) of a label grid can change its label without splitting its current superpixel:
+// its 4-neighbors of the same label must stay 4-connected through the ring of 8 cells around it.
+static bool seeds_can_move(const cluster_no_t* labels, int H, int W, int y, int x) {
+    // N, NE, E, SE, S, SW, W, NW
+    static const int dy[8] = {-1, -1, 0, 1, 1, 1, 0, -1}, dx[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+    const cluster_no_t label = labels[W * y + x];
+    bool same[8];
+    int start = -1;
+    for (int d = 0; d < 8; d++) {
+        int ny = y + dy[d], nx = x + dx[d];
+        same[d] = ny >= 0 && ny < H && nx >= 0 && nx < W && labels[W * ny + nx] == label;
+        if (!same[d]) start = d;
+    }
+    if (start < 0) return false; // interior cell
+    // Count the runs of same-label ring cells that touch an edge neighbor
+    int num_groups = 0;
+    bool in_run = false, run_has_edge = false;
+    for (int step = 1; step <= 8; step++) {
+        int d = (start + step) & 7;
+        if (same[d]) {
+            in_run = true;
+            run_has_edge |= !(d & 1);
+        }
+        if (!same[d] || step == 8) {
+            if (in_run && run_has_edge) num_groups++;
+            in_run = run_has_edge = false;
+        }
+    }
+    return num_groups == 1;
+}
+
+static void slic_seeds(int H, int W, int K, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment) {
+    if (H <= 0 || W <= 0 || K <= 0) return;
+    const int S = my_max(1, (int)sqrt(H * W / K));
+    const int block_size = my_max(2, S / 4);
+    const int BH = ceil_int(H, block_size), BW = ceil_int(W, block_size);
+    const int grid_h = my_min(K, my_max(1, (int)round(sqrt((double)K * H / W))));
+    const int grid_w = my_max(1, K / grid_h);
+    const int block_iters = my_max(1, max_iter / 2), pixel_iters = my_max(1, max_iter - block_iters);
+
+    std::vector<uint8_t> bins((size_t)H * W);
+    std::vector<float> block_hists((size_t)BH * BW * seeds_num_bins, 0.0f);
+    std::vector<float> block_sizes((size_t)BH * BW, 0.0f);
+    std::vector<float> hists((size_t)K * seeds_num_bins, 0.0f);
+    std::vector<float> sizes(K, 0.0f);
+    std::vector<cluster_no_t> block_labels((size_t)BH * BW);
+
+    #pragma omp parallel for
+    for (int i = 0; i < H; i++) {
+        for (int j = 0; j < W; j++) {
+            bins[(size_t)W * i + j] = seeds_bin(&image[3 * ((size_t)W * i + j)]);
+        }
+    }
+    for (int i = 0; i < H; i++) {
+        for (int j = 0; j < W; j++) {
+            size_t block = (size_t)BW * (i / block_size) + j / block_size;
+            block_hists[block * seeds_num_bins + bins[(size_t)W * i + j]]++;
+            block_sizes[block]++;
+        }
+    }
+
+    // Regular initial partition: each block goes to the grid cell of its center
+    for (int by = 0; by < BH; by++) {
+        for (int bx = 0; bx < BW; bx++) {
+            int cy = my_min(H - 1, by * block_size + block_size / 2), cx = my_min(W - 1, bx * block_size + block_size / 2);
+            cluster_no_t label = (cluster_no_t)((cy * grid_h / H) * grid_w + cx * grid_w / W);
+            size_t block = (size_t)BW * by + bx;
+            block_labels[block] = label;
+            sizes[label] += block_sizes[block];
+            for (int c = 0; c < seeds_num_bins; c++) hists[(size_t)label * seeds_num_bins + c] += block_hists[block * seeds_num_bins + c];
+        }
+    }
+
+    const int ny[4] = {-1, 1, 0, 0}, nx[4] = {0, 0, -1, 1};
+    for (int iter = 0; iter < block_iters; iter++) {
+        for (int by = 0; by < BH; by++) {
+            for (int bx = 0; bx < BW; bx++) {
+                size_t block = (size_t)BW * by + bx;
+                cluster_no_t label = block_labels[block];
+                cluster_no_t candidates[4];
+                int num_candidates = 0;
+                for (int d = 0; d < 4; d++) {
+                    int y = by + ny[d], x = bx + nx[d];
+                    if (y < 0 || y >= BH || x < 0 || x >= BW) continue;
+                    cluster_no_t neighbor = block_labels[(size_t)BW * y + x];
+                    if (neighbor == label || std::find(candidates, candidates + num_candidates, neighbor) != candidates + num_candidates) continue;
+                    candidates[num_candidates++] = neighbor;
+                }
+                if (num_candidates == 0 || !seeds_can_move(block_labels.data(), BH, BW, by, bx)) continue;
+
+                const float* block_hist = &block_hists[block * seeds_num_bins];
+                float best_score = seeds_intersection(block_hist, block_sizes[block], &hists[(size_t)label * seeds_num_bins], sizes[label], true);
+                cluster_no_t best = label;
+                for (int n = 0; n < num_candidates; n++) {
+                    float score = seeds_intersection(block_hist, block_sizes[block], &hists[(size_t)candidates[n] * seeds_num_bins], sizes[candidates[n]], false);
+                    if (score > best_score) {
+                        best_score = score;
+                        best = candidates[n];
+                    }
+                }
+                if (best == label) continue;
+
+                float* from = &hists[(size_t)label * seeds_num_bins];
+                float* to = &hists[(size_t)best * seeds_num_bins];
+                for (int c = 0; c < seeds_num_bins; c += 8) {
+                    __m256 block_vec = _mm256_loadu_ps(block_hist + c);
+                    _mm256_storeu_ps(from + c, _mm256_sub_ps(_mm256_loadu_ps(from + c), block_vec));
+                    _mm256_storeu_ps(to + c, _mm256_add_ps(_mm256_loadu_ps(to + c), block_vec));
+                }
+                sizes[label] -= block_sizes[block];
+                sizes[best] += block_sizes[block];
+                block_labels[block] = best;
+            }
+        }
+    }
+
+    std::vector<cluster_no_t> labels((size_t)H * W);
+    #pragma omp parallel for
+    for (int i = 0; i < H; i++) {
+        for (int j = 0; j < W; j++) {
+            labels[(size_t)W * i + j] = block_labels[(size_t)BW * (i / block_size) + j / block_size];
+        }
+    }
+
+    // Pixel level: a boundary pixel goes to the neighbor whose histogram gives its color the highest probability,
+    // weighted by the number of its 8-neighbors already in that superpixel (the boundary term of SEEDS)
+    for (int iter = 0; iter < pixel_iters; iter++) {
+        for (int i = 0; i < H; i++) {
+            for (int j = 0; j < W; j++) {
+                size_t index = (size_t)W * i + j;
+                cluster_no_t label = labels[index];
+                if (i > 0 && i < H - 1 && j > 0 && j < W - 1 && labels[index - 1] == label && labels[index + 1] == label &&
+                        labels[index - W] == label && labels[index + W] == label) continue;
+                cluster_no_t candidates[4];
+                int num_candidates = 0;
+                for (int d = 0; d < 4; d++) {
+                    int y = i + ny[d], x = j + nx[d];
+                    if (y < 0 || y >= H || x < 0 || x >= W) continue;
+                    cluster_no_t neighbor = labels[(size_t)W * y + x];
+                    if (neighbor == label || std::find(candidates, candidates + num_candidates, neighbor) != candidates + num_candidates) continue;
+                    candidates[num_candidates++] = neighbor;
+                }
+                if (num_candidates == 0 || sizes[label] <= 1) continue;
+
+                int neighbor_counts[5] = {0, 0, 0, 0, 0};
+                for (int y = my_max(0, i - 1); y <= my_min(H - 1, i + 1); y++) {
+                    for (int x = my_max(0, j - 1); x <= my_min(W - 1, j + 1); x++) {
+                        cluster_no_t neighbor = labels[(size_t)W * y + x];
+                        if (neighbor == label) neighbor_counts[4]++;
+                        for (int n = 0; n < num_candidates; n++) {
+                            if (neighbor == candidates[n]) neighbor_counts[n]++;
+                        }
+                    }
+                }
+
+                const int bin = bins[index];
+                // neighbor_counts[4] includes the pixel itself
+                float best_score = (hists[(size_t)label * seeds_num_bins + bin] - 1) / (sizes[label] - 1) * neighbor_counts[4];
+                int best = -1;
+                for (int n = 0; n < num_candidates; n++) {
+                    float score = hists[(size_t)candidates[n] * seeds_num_bins + bin] / sizes[candidates[n]] * (neighbor_counts[n] + 1);
+                    if (score > best_score) {
+                        best_score = score;
+                        best = n;
+                    }
+                }
+                if (best < 0 || !seeds_can_move(labels.data(), H, W, i, j)) continue;
+
+                cluster_no_t target = candidates[best];
+                hists[(size_t)label * seeds_num_bins + bin]--;
+                hists[(size_t)target * seeds_num_bins + bin]++;
+                sizes[label]--;
+                sizes[target]++;
+                labels[index] = target;
+            }
+        }
+    }
+
+    std::vector<int64_t> acc_vec((size_t)K * 5, 0); // sum of [y, x, r, g, b] in cluster
+    std::vector<uint32_t> num_members(K, 0);
+    for (int i = 0; i < H; i++) {
+        for (int j = 0; j < W; j++) {
+            size_t index = (size_t)W * i + j;
+            cluster_no_t label = labels[index];
+            assignment[index] = label;
+            num_members[label]++;
+            acc_vec[5 * label + 0] += i;
+            acc_vec[5 * label + 1] += j;
+            acc_vec[5 * label + 2] += image[3 * index];
+            acc_vec[5 * label + 3] += image[3 * index + 1];
+            acc_vec[5 * label + 4] += image[3 * index + 2];
+        }
+    }
+    for (int k = 0; k < K; k++) {
+        Cluster* cluster = &clusters[k];
+        uint32_t n = num_members[k];
+        cluster->number = k;
+        cluster->num_members = n;
+        if (n == 0) continue;
+        cluster->y = (uint16_t)round_int<int64_t>(acc_vec[5 * k + 0], n);
+        cluster->x = (uint16_t)round_int<int64_t>(acc_vec[5 * k + 1], n);
+        cluster->r = (uint8_t)round_int<int64_t>(acc_vec[5 * k + 2], n);
+        cluster->g = (uint8_t)round_int<int64_t>(acc_vec[5 * k + 3], n);
+        cluster->b = (uint8_t)round_int<int64_t>(acc_vec[5 * k + 4], n);
+    }
+}
+
+// fast_slic_iterate_avx2_ex; the coarse stage of the pyramid mode runs it without the connectivity enforcement
+static void slic_iterate_avx2(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t *__restrict__ image, Cluster *__restrict__ clusters, uint32_t* __restrict__ assignment, const SlicOptions* options, bool enforce_connectivity) {
+    int S = sqrt(H * W / K);
+    IterationDeadline deadline(options != nullptr ? options->time_budget_ms : 0, (size_t)H * W, options != nullptr ? options->finish_ns_per_pixel : nullptr);
+    int* num_iterations = (options != nullptr) ? options->num_iterations : nullptr;
+    if (num_iterations != nullptr) *num_iterations = 0;
+
+    // Adaptive density: per-cluster window sizes, padded for the largest
+    const bool adaptive = options != nullptr && options->prev_image == nullptr && options->cluster_S != nullptr;
+    if (adaptive) {
+        S = *std::max_element(options->cluster_S, options->cluster_S + K);
+    }
+
+    // Incremental mode: find the tiles that changed since the previous frame and the clusters they affect
+    const bool incremental = options != nullptr && options->prev_image != nullptr;
+    // RGB-D mode: the depth joins the color distance of the cluster-oriented kernel
+    const bool rgbd = options != nullptr && !incremental && options->depth != nullptr;
+    // Adaptive density and RGB-D only run on the cluster-oriented kernel
+    const bool cluster_oriented_only = adaptive || rgbd;
+    std::vector<uint8_t> changed_tiles, dirty_clusters;
+    if (incremental) {
+        float threshold = (options->incremental_threshold > 0) ? options->incremental_threshold : 3.0f;
+        if (find_changed_tiles(H, W, options->prev_image, image, threshold, changed_tiles) == 0) {
+            // Nothing moved: previous labels and clusters are still valid
+            if (options->num_saturated != nullptr) *options->num_saturated = 0;
+            return;
+        }
+    }
+
+    // SNIC replaces the iterations and the blob removal with a single region growing pass
+    if (!incremental && options != nullptr && options->algorithm != nullptr && !strcmp(options->algorithm, "snic")) {
+        do_fast_slic_snic(H, W, K, compactness, quantize_level, image, clusters, assignment);
+        return;
+    }
+    if (!incremental && options != nullptr && options->algorithm != nullptr && !strcmp(options->algorithm, "seeds")) {
+        slic_seeds(H, W, K, max_iter, image, clusters, assignment);
+        return;
+    }
+
+    // Pyramid mode: all but the last iterations run on a downsampled image,
+    // the last ones only refine the boundary band at full resolution
+    const int pyramid_levels = (options != nullptr && !incremental && !cluster_oriented_only) ? my_min(options->pyramid_levels, 2) : 0;
+    const bool pyramid = pyramid_levels > 0 && max_iter >= 2 && (S >> pyramid_levels) >= 3;
+    // Tiled mode keeps its own buffers, without the band and bounds modes
+    const bool tiled = !pyramid && !cluster_oriented_only && options != nullptr && !incremental && options->algorithm != nullptr && !strcmp(options->algorithm, "tiled");
+    int band_start_iter = max_iter, band_width = 0;
+    int num_coarse_iter = 0;
+    if (pyramid) {
+        const int fine_iter = (max_iter > 2) ? 2 : 1;
+        // The coarse iterations are cheap and always run; the deadline only bounds the fine ones
+        num_coarse_iter = max_iter - fine_iter;
+        slic_iterate_coarse(H, W, K, compactness, min_size_factor, quantize_level, num_coarse_iter, pyramid_levels, image, clusters, assignment);
+        max_iter = fine_iter;
+        band_start_iter = 0;
+        band_width = 1 << pyramid_levels;
+    } else if (options != nullptr && !incremental && !cluster_oriented_only && !tiled && options->band_start_iter > 0) {
+        // Boundary-band mode: after band_start_iter full iterations, labels only move near the boundaries
+        band_start_iter = options->band_start_iter;
+        band_width = (options->band_width > 0) ? my_min(options->band_width, 1 << band_block_shift) : 2;
+    }
+    // Bounds mode: from bound_start_iter on, rows whose distance bounds still hold are not re-evaluated
+    int bound_start_iter = max_iter;
+    if (!pyramid && !cluster_oriented_only && !tiled && band_start_iter >= max_iter && options != nullptr && !incremental && options->bound_start_iter > 0) {
+        bound_start_iter = options->bound_start_iter;
+    }
+    // Extent mode: from the third assignment on, each window only covers its cluster's member box plus this margin
+    const int extent_margin = (options != nullptr && !incremental && !pyramid && !tiled) ? my_max(options->extent_margin, 0) : 0;
+    // Subsampled mode: the first iterations only settle the centers, on every other row.
+    // The update before a band or bounds iteration must see every pixel.
+    int subsample_iters = 0;
+    if (options != nullptr && !incremental && !pyramid) {
+        subsample_iters = my_min(options->subsample_iters, my_min(max_iter, my_min(band_start_iter, bound_start_iter)) - 1);
+    }
+
+    Context context;
+    context.image = image;
+    context.algorithm = "cluster_oriented";
+    if (tiled) {
+        context.algorithm = "tiled";
+    }
+    context.H = H;
+    context.W = W;
+    context.K = K;
+    context.S = (int16_t)S;
+    if (adaptive) context.cluster_S = options->cluster_S;
+    context.assignment = assignment;
+    context.compactness = compactness;
+    context.min_size_factor = min_size_factor;
+    context.quantize_level = quantize_level;
+    context.clusters = clusters;
+    context.update_y_lo = 0;
+    context.update_y_hi = H;
+    context.update_x_lo = 0;
+    context.update_x_hi = W;
+    if (incremental) {
+        find_dirty_clusters(&context, changed_tiles, dirty_clusters);
+    }
+
+    // Pad image and assignment (only the update region is read in incremental mode).
+    // The tiled mode copies the image into its tiles instead.
+    if (!tiled) {
+        // Segments are loaded 32 bytes at a time for 24 bytes of pixels, hence the slack after the last row
+        int rgb_image_memory_width;
+        context.rgb_image_memory_width = rgb_image_memory_width = simd_helper::align_to_next((W + 2 * S) * 3);
+        uint8_t* aligned_rgb_image_base = simd_helper::alloc_aligned_array<uint8_t>((size_t)(H + 2 * S) * rgb_image_memory_width + 32);
+        for (int i = context.update_y_lo; i < context.update_y_hi; i++) {
+            std::memcpy(
+                &aligned_rgb_image_base[(size_t)(i + S) * rgb_image_memory_width + 3 * (context.update_x_lo + S)],
+                &image[(size_t)W * 3 * i + 3 * context.update_x_lo],
+                3 * (context.update_x_hi - context.update_x_lo)
+            );
+        }
+
+        context.aligned_rgb_image_base = aligned_rgb_image_base;
+        context.aligned_rgb_image = &aligned_rgb_image_base[rgb_image_memory_width * S + S * 3];
+        uint32_t assignment_memory_width = simd_helper::align_to_next(W + 2 * S);
+        context.aligned_assignment_base = simd_helper::alloc_aligned_array<uint32_t>((H + 2 * S) * assignment_memory_width);
+        context.assignment_memory_width = assignment_memory_width;
+        context.aligned_assignment = &context.aligned_assignment_base[S * assignment_memory_width + S];
+    }
+
+    if (options != nullptr && options->num_saturated != nullptr && !strcmp(context.algorithm, "cluster_oriented") &&
+            band_start_iter >= max_iter && bound_start_iter >= max_iter) {
+        *options->num_saturated = 0;
+        context.num_saturated = options->num_saturated;
+    }
+    context.prepare_spatial();
+    if (rgbd) {
+        prepare_depth(&context, options->depth, options->depth_weight);
+    }
+    if (tiled) {
+        prepare_tiled(&context);
+    } else if (incremental) {
+        // Unchanged pixels start with their previous label at distance 0 so that no cluster takes them over
+        context.changed_tiles = changed_tiles.data();
+        context.dirty_clusters = dirty_clusters.data();
+        context.num_tile_cols = ceil_int(W, 1 << incremental_tile_shift);
+        #pragma omp parallel for
+        for (int i = 0; i < H; i++) {
+            for (int j = 0; j < W; j++) {
+                uint32_t prev_label = assignment[W * i + j];
+                bool changed = changed_tiles[(i >> incremental_tile_shift) * context.num_tile_cols + (j >> incremental_tile_shift)];
+                context.aligned_assignment[context.assignment_memory_width * i + j] = (changed || prev_label >= (uint32_t)K) ? 0xFFFFFFFF : prev_label;
+            }
+        }
+    } else if (pyramid) {
+        #pragma omp parallel for
+        for (int i = 0; i < H; i++) {
+            for (int j = 0; j < W; j++) {
+                context.aligned_assignment[context.assignment_memory_width * i + j] = assignment[W * i + j];
+            }
+        }
+    } else {
+        // auto t1 = Clock::now();
+        __m256i constant = _mm256_set1_epi32(0xFFFFFFFF);
+        #pragma omp parallel for
+        for (int i = 0; i < H; i++) {
+            #pragma unroll(4)
+            #pragma GCC unroll(4)
+            for (int j = 0; j < W; j += 8) {
+                _mm256_storeu_si256((__m256i *)&context.aligned_assignment[context.assignment_memory_width * i + j], constant);
+            }
+        }
+        // auto t2 = Clock::now();
+        // std::cerr << "Assignment Initialization " << std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us \n";
+    }
+
+
+    BoundaryBand band;
+    DistanceBounds bounds;
+    for (int i = 0; i < max_iter; i++) {
+        if (!deadline.begin_iteration()) break;
+        if (i >= bound_start_iter) {
+            slic_assign_bounded(&context, bounds);
+            update_cluster_centers(&context, bounds.sums.num_cluster_members.data(), bounds.sums.cluster_acc_vec.data());
+            continue;
+        }
+        if (i >= band_start_iter) {
+            if (i == band_start_iter) {
+                if (band.sums.num_cluster_members.empty()) {
+                    slic_update_clusters(&context, false, &band.sums);
+                }
+                if (init_boundary_band(&context, band_width, band) == 0) break;
+            }
+            int num_band_segments = slic_assign_band(&context, band);
+            update_cluster_centers(&context, band.sums.num_cluster_members.data(), band.sums.cluster_acc_vec.data());
+            if (num_band_segments == 0) break;
+            continue;
+        }
+        context.row_step = (i < subsample_iters) ? 2 : 1;
+        // auto t1 = Clock::now();
+        slic_assign(&context);
+        // auto t2 = Clock::now();
+        ClusterSums* sums = (i + 1 == band_start_iter) ? &band.sums : (i + 1 == bound_start_iter) ? &bounds.sums : nullptr;
+        bool reset = i + 1 < max_iter && i + 1 < band_start_iter && i + 1 < bound_start_iter;
+        // The resetting update clears the labels for the next assignment, so decide on the deadline before it
+        const bool last = reset && !deadline.allows_next();
+        if (last) reset = false;
+        // The first windows are still far from their members
+        context.extent_margin = (i >= 1) ? extent_margin : 0;
+        deadline.begin_update();
+        slic_update_clusters(&context, reset, sums);
+        deadline.end_update();
+        if (last) break;
+        // auto t3 = Clock::now();
+        // std::cerr << "assignment " << std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us \n";
+        // std::cerr << "update "<< std::chrono::duration_cast<std::chrono::microseconds>(t3-t2).count() << "us \n";
+    }
+
+
+
+
+    deadline.begin_finish();
+    {
+        // auto t1 = Clock::now();
+        for (int i = 0; i < H; i++) {
+            for (int j = 0; j < W; j++) {
+                if (tiled) {
+                    assignment[W * i + j] = context.tiled_assignment[tiled_index(&context, i, j)] & 0x0000FFFF;
+                } else {
+                    assignment[W * i + j] = context.aligned_assignment[context.assignment_memory_width * i + j] & 0x0000FFFF;
+                }
+            }
+        }
+        // auto t2 = Clock::now();
+        // std::cerr << "Write back assignment"<< std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us \n";
+    }
+    // auto t1 = Clock::now();
+    if (incremental) {
+        slic_enforce_connectivity_changed_rows(&context, changed_tiles);
+        update_reference_tiles(H, W, image, options->prev_image, changed_tiles);
+    } else if (enforce_connectivity) {
+        slic_enforce_connectivity(&context);
+    }
+    // The enforcement over the changed rows only says little about a full one
+    if (!incremental) deadline.end_finish();
+    if (num_iterations != nullptr) *num_iterations = num_coarse_iter + deadline.num_iterations;
+    // auto t2 = Clock::now();
+
+    // std::cerr << "enforce connectivity "<< std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us \n";
 }
 
 extern "C" {
@@ -357,11 +2120,23 @@ extern "C" {
     }
 
     void fast_slic_iterate_avx2(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t *__restrict__ image, Cluster *__restrict__ clusters, uint32_t* __restrict__ assignment) {
-        int S = sqrt(H * W / K);
+        fast_slic_iterate_avx2_ex(H, W, K, compactness, min_size_factor, quantize_level, max_iter, image, clusters, assignment, nullptr);
+    }
+
+    void fast_slic_iterate_avx2_ex(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t *__restrict__ image, Cluster *__restrict__ clusters, uint32_t* __restrict__ assignment, const SlicOptions* options) {
+        slic_iterate_avx2(H, W, K, compactness, min_size_factor, quantize_level, max_iter, image, clusters, assignment, options, true);
+    }
+
+    // Supervoxels of a volume. image: uint8_t[D, H, W, 3], assignment: uint32_t[D, H, W].
+    // clusters and cluster_z (the slice of each cluster) come from fast_slic_initialize_clusters_3d.
+    void fast_slic_iterate_avx2_3d(int D, int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint16_t* cluster_z, uint32_t* assignment) {
+        if (D <= 0 || H <= 0 || W <= 0 || K <= 0) return;
+        const int S = my_max(1, (int)cbrt((double)D * H * W / K));
 
         Context context;
         context.image = image;
         context.algorithm = "cluster_oriented";
+        context.D = D;
         context.H = H;
         context.W = W;
         context.K = K;
@@ -371,72 +2146,136 @@ extern "C" {
         context.min_size_factor = min_size_factor;
         context.quantize_level = quantize_level;
         context.clusters = clusters;
-
-        // Pad image and assignment
-        uint32_t quad_image_memory_width;
-        context.quad_image_memory_width = quad_image_memory_width = simd_helper::align_to_next((W + 2 * S) * 4);
-        uint8_t* aligned_quad_image_base = simd_helper::alloc_aligned_array<uint8_t>((H + 2 * S) * quad_image_memory_width);
-        for (int i = 0; i < H; i++) {
-            for (int j = 0; j < W; j++) {
-                for (int k = 0; k < 3; k++) {
-                    aligned_quad_image_base[(i + S) * quad_image_memory_width + 4 * (j + S) + k] = image[i * W * 3 + 3 * j + k];
-                }
-            }
+        context.cluster_z = cluster_z;
+
+        // Each slice padded by S rows and columns, like an image; the window never leaves its slices in z
+        context.slice_memory_height = H + 2 * S;
+        const size_t num_rows = (size_t)D * context.slice_memory_height;
+        context.rgb_image_memory_width = simd_helper::align_to_next((W + 2 * S) * 3);
+        context.aligned_rgb_image_base = simd_helper::alloc_aligned_array<uint8_t>(num_rows * context.rgb_image_memory_width + 32);
+        context.aligned_rgb_image = &context.aligned_rgb_image_base[(size_t)context.rgb_image_memory_width * S + S * 3];
+        context.assignment_memory_width = simd_helper::align_to_next(W + 2 * S);
+        context.aligned_assignment_base = simd_helper::alloc_aligned_array<uint32_t>(num_rows * context.assignment_memory_width);
+        context.aligned_assignment = &context.aligned_assignment_base[context.assignment_memory_width * S + S];
+        std::fill_n(context.aligned_assignment_base, num_rows * context.assignment_memory_width, 0xFFFFFFFF);
+
+        #pragma omp parallel for
+        for (int zi = 0; zi < D * H; zi++) {
+            const size_t row = (size_t)(zi / H) * context.slice_memory_height + zi % H;
+            std::memcpy(&context.aligned_rgb_image[context.rgb_image_memory_width * row], &image[(size_t)W * 3 * zi], 3 * W);
         }
+        context.prepare_spatial();
 
-        context.aligned_quad_image_base = aligned_quad_image_base;
-        context.aligned_quad_image = &aligned_quad_image_base[quad_image_memory_width * S + S * 4];
-        uint32_t assignment_memory_width = simd_helper::align_to_next(W + 2 * S);
-        context.aligned_assignment_base = simd_helper::alloc_aligned_array<uint32_t>((H + 2 * S) * assignment_memory_width);
-        context.assignment_memory_width = assignment_memory_width;
-        context.aligned_assignment = &context.aligned_assignment_base[S * assignment_memory_width + S];
+        for (int i = 0; i < max_iter; i++) {
+            slic_assign_volume(&context);
+            slic_update_clusters_volume(&context, i + 1 < max_iter);
+        }
 
-        context.prepare_spatial();
-        {
-            // auto t1 = Clock::now();
-            __m256i constant = _mm256_set1_epi32(0xFFFFFFFF);
-            #pragma omp parallel for
-            for (int i = 0; i < H; i++) {
-                #pragma unroll(4)
-                #pragma GCC unroll(4)
-                for (int j = 0; j < W; j += 8) {
-                    _mm256_storeu_si256((__m256i *)&context.aligned_assignment[assignment_memory_width * i + j], constant);
-                }
+        #pragma omp parallel for
+        for (int zi = 0; zi < D * H; zi++) {
+            const size_t row = (size_t)(zi / H) * context.slice_memory_height + zi % H;
+            for (int j = 0; j < W; j++) {
+                assignment[(size_t)W * zi + j] = context.aligned_assignment[context.assignment_memory_width * row + j] & 0x0000FFFF;
             }
-            // auto t2 = Clock::now();
-            // std::cerr << "Assignment Initialization " << std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us \n";
         }
+        slic_enforce_connectivity(&context);
+    }
 
+    // motion: int16_t[] of shape [K, 2], displacement (dy, dx) of each cluster between the frames
+    void fast_slic_estimate_motion_avx2(int H, int W, int K, const uint8_t* prev_image, const uint8_t* image, const uint32_t* prev_assignment, int search_radius, int16_t* motion) {
+        if (H <= 0 || W <= 0 || K <= 0) return;
+        std::vector<ClusterBox> boxes;
+        compute_cluster_boxes(H, W, K, prev_assignment, boxes);
+        const int r = my_max(search_radius, 0);
 
-        for (int i = 0; i < max_iter; i++) {
-            // auto t1 = Clock::now();
-            slic_assign(&context);
-            // auto t2 = Clock::now();
-            slic_update_clusters(&context, i + 1 < max_iter);
-            // auto t3 = Clock::now();
-            // std::cerr << "assignment " << std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us \n";
-            // std::cerr << "update "<< std::chrono::duration_cast<std::chrono::microseconds>(t3-t2).count() << "us \n";
-        }
-
+        #pragma omp parallel
+        {
+            // Packed RGB rows of the cluster box in the previous frame and a byte mask of its members;
+            // the box grown by the search radius in the current frame and a byte mask of its pixels inside the image
+            std::vector<uint8_t> patch_base, mask_base, window_base, inside_base;
 
+            #pragma omp for schedule(dynamic)
+            for (int k = 0; k < K; k++) {
+                const ClusterBox &box = boxes[k];
+                motion[2 * k] = motion[2 * k + 1] = 0;
+                if (box.y_lo >= box.y_hi) continue;
+
+                const int box_height = box.y_hi - box.y_lo, box_width = box.x_hi - box.x_lo;
+                const int row_bytes = 3 * box_width;
+                const int row_memory_width = simd_helper::align_to_next(row_bytes);
+                patch_base.assign((size_t)box_height * row_memory_width + Alignment, 0);
+                mask_base.assign((size_t)box_height * row_memory_width + Alignment, 0);
+                uint8_t* patch = (uint8_t *)simd_helper::align_to_next((uintptr_t)patch_base.data());
+                uint8_t* mask = (uint8_t *)simd_helper::align_to_next((uintptr_t)mask_base.data());
+                for (int i = 0; i < box_height; i++) {
+                    for (int j = 0; j < box_width; j++) {
+                        int index = W * (box.y_lo + i) + box.x_lo + j;
+                        if (prev_assignment[index] != (uint32_t)k) continue;
+                        for (int c = 0; c < 3; c++) {
+                            patch[i * row_memory_width + 3 * j + c] = prev_image[3 * index + c];
+                            mask[i * row_memory_width + 3 * j + c] = 0xFF;
+                        }
+                    }
+                }
 
+                // A patch row read at the largest displacement ends row_memory_width bytes after 6r
+                const int window_memory_width = row_memory_width + 6 * r;
+                window_base.assign((size_t)(box_height + 2 * r) * window_memory_width, 0);
+                inside_base.assign((size_t)(box_height + 2 * r) * window_memory_width, 0);
+                for (int i = 0; i < box_height + 2 * r; i++) {
+                    const int y = box.y_lo - r + i;
+                    if (y < 0 || y >= H) continue;
+                    const int x_lo = my_max(0, (int)box.x_lo - r), x_hi = my_min(W, (int)box.x_hi + r);
+                    const size_t offset = (size_t)i * window_memory_width + 3 * (x_lo - (box.x_lo - r));
+                    std::memcpy(&window_base[offset], image + 3 * ((size_t)W * y + x_lo), 3 * (x_hi - x_lo));
+                    std::fill_n(&inside_base[offset], 3 * (x_hi - x_lo), 0xFF);
+                }
 
-        {
-            // auto t1 = Clock::now();
-            for (int i = 0; i < H; i++) {
-                for (int j = 0; j < W; j++) {
-                    assignment[W * i + j] = context.aligned_assignment[context.assignment_memory_width * i + j] & 0x0000FFFF;
+                // Every displacement within the radius is searched. Members that leave the image do not count,
+                // so the scores are mean absolute differences over the members still inside; (0, 0) wins ties.
+                const int num_dx = 2 * r + 1;
+                const __m256i ones = _mm256_set1_epi8(1);
+                uint64_t min_sad = 0, min_count = 0;
+                for (int d = -1; d < num_dx * num_dx; d++) {
+                    int dy = (d < 0) ? 0 : d / num_dx - r;
+                    int dx = (d < 0) ? 0 : d % num_dx - r;
+                    __m256i sad_acc = _mm256_setzero_si256(), count_acc = _mm256_setzero_si256();
+                    for (int i = 0; i < box_height; i++) {
+                        const size_t window_offset = (size_t)(i + r + dy) * window_memory_width + 3 * (r + dx);
+                        const uint8_t* window_row = &window_base[window_offset];
+                        const uint8_t* inside_row = &inside_base[window_offset];
+                        const uint8_t* patch_row = patch + i * row_memory_width;
+                        const uint8_t* mask_row = mask + i * row_memory_width;
+                        for (int b = 0; b < row_bytes; b += 32) {
+                            __m256i segment = _mm256_loadu_si256((const __m256i *)(window_row + b));
+                            __m256i prev_segment = _mm256_load_si256((const __m256i *)(patch_row + b));
+                            __m256i overlap = _mm256_and_si256(
+                                _mm256_load_si256((const __m256i *)(mask_row + b)),
+                                _mm256_loadu_si256((const __m256i *)(inside_row + b))
+                            );
+                            __m256i abs_diff = _mm256_or_si256(_mm256_subs_epu8(segment, prev_segment), _mm256_subs_epu8(prev_segment, segment));
+                            abs_diff = _mm256_and_si256(abs_diff, overlap);
+                            sad_acc = _mm256_add_epi64(sad_acc, _mm256_sad_epu8(abs_diff, _mm256_setzero_si256()));
+                            count_acc = _mm256_add_epi64(count_acc, _mm256_sad_epu8(_mm256_and_si256(overlap, ones), _mm256_setzero_si256()));
+                        }
+                    }
+                    ALIGN_SIMD uint64_t sads[4], counts[4];
+                    _mm256_store_si256((__m256i *)sads, sad_acc);
+                    _mm256_store_si256((__m256i *)counts, count_acc);
+                    uint64_t sad = sads[0] + sads[1] + sads[2] + sads[3];
+                    // Overlapping channel bytes, three per member
+                    uint64_t count = counts[0] + counts[1] + counts[2] + counts[3];
+                    if (count > 0 && (min_count == 0 || sad * min_count < min_sad * count)) {
+                        min_sad = sad;
+                        min_count = count;
+                        motion[2 * k] = dy;
+                        motion[2 * k + 1] = dx;
+                    }
                 }
             }
-            // auto t2 = Clock::now();
-            // std::cerr << "Write back assignment"<< std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us \n";
         }
-        // auto t1 = Clock::now();
-        slic_enforce_connectivity(&context);
-        // auto t2 = Clock::now();
-
-        // std::cerr << "enforce connectivity "<< std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us \n";
     }
+
     int fast_slic_supports_avx2() { return 1; }
 }
 
@@ -445,6 +2284,9 @@ extern "C" {
 extern "C" {
     void fast_slic_initialize_clusters_avx2(int H, int W, int K, const uint8_t* image, Cluster *clusters) {}
     void fast_slic_iterate_avx2(int H, int W, int K, float compactness, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment) {}
+    void fast_slic_iterate_avx2_ex(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment, const SlicOptions* options) {}
+    void fast_slic_iterate_avx2_3d(int D, int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint16_t* cluster_z, uint32_t* assignment) {}
+    void fast_slic_estimate_motion_avx2(int H, int W, int K, const uint8_t* prev_image, const uint8_t* image, const uint32_t* prev_assignment, int search_radius, int16_t* motion) {}
 int fast_slic_supports_avx2() { return 0; }
 }
 
@@ -469,6 +2311,12 @@ int main(int argc, char** argv) {
     int compactness = 5;
     int max_iter = 2;
     int quantize_level = 6;
+    int H = 480;
+    int W = 640;
+    SlicOptions options;
+    std::memset(&options, 0, sizeof(options));
+    int num_iterations = 0;
+    options.num_iterations = &num_iterations;
     try { 
         if (argc > 1) {
             K = std::stoi(std::string(argv[1]));
@@ -482,13 +2330,24 @@ int main(int argc, char** argv) {
         if (argc > 4) {
             quantize_level = std::stoi(std::string(argv[4]));
         }
+        // e.g. 2160 3840 to time frames whose windows no longer fit in L2
+        if (argc > 6) {
+            H = std::stoi(std::string(argv[5]));
+            W = std::stoi(std::string(argv[6]));
+        }
+        // e.g. seeds or snic to compare them with the default cluster-oriented kernel
+        if (argc > 7) {
+            options.algorithm = argv[7];
+        }
+        // e.g. cluster_oriented 20 to see how many iterations fit in 20 ms and how close the run ends to it
+        if (argc > 8) {
+            options.time_budget_ms = std::stof(std::string(argv[8]));
+        }
     } catch (...) {
-        std::cerr << "slic num_components compactness max_iter quantize_level" << std::endl;
+        std::cerr << "slic num_components compactness max_iter quantize_level [height width [algorithm [time_budget_ms]]]" << std::endl;
         return 2;
     }
 
-    int H = 480;
-    int W = 640;
     srand(time(nullptr));
 
     Cluster clusters[K];
@@ -521,11 +2380,11 @@ int main(int argc, char** argv) {
 
     auto t1 = Clock::now();
     fast_slic_initialize_clusters_avx2(H, W, K, image.get(), clusters);
-    fast_slic_iterate_avx2(H, W, K, compactness, 0.1, quantize_level, max_iter, image.get(), clusters, assignment.get());
+    fast_slic_iterate_avx2_ex(H, W, K, compactness, 0.1, quantize_level, max_iter, image.get(), clusters, assignment.get(), &options);
 
     auto t2 = Clock::now();
     // 6 times faster than skimage.segmentation.slic
-    std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us \n";
+    std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us, " << num_iterations << " iterations \n";
 
     {
         std::ofstream outputf("/tmp/b.output.txt");
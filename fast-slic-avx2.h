@@ -9,6 +9,9 @@ extern "C" {
 #endif
     void fast_slic_initialize_clusters_avx2(int H, int W, int K, const uint8_t* image, Cluster *clusters);
     void fast_slic_iterate_avx2(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment);
+    void fast_slic_iterate_avx2_ex(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment, const SlicOptions* options);
+    void fast_slic_iterate_avx2_3d(int D, int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint16_t* cluster_z, uint32_t* assignment);
+    void fast_slic_estimate_motion_avx2(int H, int W, int K, const uint8_t* prev_image, const uint8_t* image, const uint32_t* prev_assignment, int search_radius, int16_t* motion);
     int fast_slic_supports_avx2();
 #ifdef __cplusplus
 }
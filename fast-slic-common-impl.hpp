@@ -14,6 +14,7 @@
 #include <climits>
 #include <list>
 #include <atomic>
+#include <mutex>
 #include "simd-helper.hpp"
 #include "fast-slic-common.h"
 
@@ -69,57 +70,58 @@ static T round_int(T numer, T denom) {
     return (numer + (denom / 2)) / denom;
 }
 
-class BaseContext {
-public:
-    int H, W, K;
+// Spatial distance tables of a given (S, compactness, quantize_level).
+// Read-only once built, so they can be shared between contexts.
+struct SpatialPatch {
     int16_t S;
-    const char* algorithm;
     float compactness;
-    float min_size_factor = 0.1;
     uint8_t quantize_level;
-    Cluster* __restrict__ clusters;
-    const uint8_t* __restrict__ image = nullptr;
-    uint16_t* __restrict__ spatial_dist_patch = nullptr;
-    uint16_t* __restrict__ spatial_normalize_cache = nullptr;
-    uint32_t* __restrict__ assignment = nullptr;
-
-public:
-    virtual ~BaseContext() {
-        if (spatial_dist_patch) {
-            simd_helper::free_aligned_array(spatial_dist_patch);
-        }
-        if (spatial_normalize_cache) {
-            delete [] spatial_normalize_cache;
-        }
-    }
-
-    virtual void prepare_spatial() {
-        if (spatial_normalize_cache) delete [] spatial_normalize_cache;
-        spatial_normalize_cache = new uint16_t[2 * S + 2];
-        for (int x = 0; x < 2 * S + 2; x++) {
+    // Volumes: dist_patch holds 2S + 1 slices of the window, one per z offset
+    bool volume;
+    uint16_t patch_memory_width;
+    uint16_t* __restrict__ normalize_cache = nullptr;
+    uint16_t* __restrict__ dist_patch = nullptr;
+
+    SpatialPatch(int16_t S, float compactness, uint8_t quantize_level, bool volume = false) : S(S), compactness(compactness), quantize_level(quantize_level), volume(volume) {
+        // Manhattan distances reach 3S in a volume window
+        const int normalize_cache_size = (volume ? 3 * S : 2 * S) + 2;
+        normalize_cache = new uint16_t[normalize_cache_size];
+        for (int x = 0; x < normalize_cache_size; x++) {
             // rescale distance [0, 1] to [0, 25.5] (color-scale).
-            spatial_normalize_cache[x] = (uint16_t)(compactness * ((float)x / (2 * S) * 25.5f) * (1 << quantize_level));
-
+            normalize_cache[x] = (uint16_t)(compactness * ((float)x / (2 * S) * 25.5f) * (1 << quantize_level));
         }
 
         const uint16_t patch_height = 2 * S + 1, patch_virtual_width = 2 * S + 1;
-        const uint16_t patch_memory_width = simd_helper::align_to_next(patch_virtual_width);
+        patch_memory_width = simd_helper::align_to_next(patch_virtual_width);
+
+        if (volume) {
+            const int patch_depth = 2 * S + 1;
+            dist_patch = simd_helper::alloc_aligned_array<uint16_t>(patch_depth * patch_height * patch_memory_width);
+            for (int d = 0; d < patch_depth; d++) {
+                for (int i = 0; i < patch_height; i++) {
+                    uint16_t* row = &dist_patch[(d * patch_height + i) * patch_memory_width];
+                    for (int j = 0; j < patch_virtual_width; j++) {
+                        row[j] = normalize_cache[fast_abs(d - S) + fast_abs(i - S) + fast_abs(j - S)];
+                    }
+                }
+            }
+            return;
+        }
 
-        if (spatial_dist_patch) simd_helper::free_aligned_array(spatial_dist_patch);
-        spatial_dist_patch = simd_helper::alloc_aligned_array<uint16_t>(patch_height * patch_memory_width);
+        dist_patch = simd_helper::alloc_aligned_array<uint16_t>(patch_height * patch_memory_width);
         uint16_t row_first_manhattan = 2 * S;
         // first half lines
         for (int i = 0; i < S; i++) {
             uint16_t current_manhattan = row_first_manhattan--;
             // first half columns
             for (int j = 0; j < S; j++) {
-                uint16_t val = spatial_normalize_cache[current_manhattan--];
-                spatial_dist_patch[i * patch_memory_width + j] = val;
+                uint16_t val = normalize_cache[current_manhattan--];
+                dist_patch[i * patch_memory_width + j] = val;
             }
             // half columns next to the first columns
             for (int j = S; j <= 2 * S; j++) {
-                uint16_t val = spatial_normalize_cache[current_manhattan++];
-                spatial_dist_patch[i * patch_memory_width + j] = val;
+                uint16_t val = normalize_cache[current_manhattan++];
+                dist_patch[i * patch_memory_width + j] = val;
             }
         }
 
@@ -128,16 +130,127 @@ public:
             uint16_t current_manhattan = row_first_manhattan++;
             // first half columns
             for (int j = 0; j < S; j++) {
-                uint16_t val = spatial_normalize_cache[current_manhattan--];
-                spatial_dist_patch[i * patch_memory_width + j] = val;
+                uint16_t val = normalize_cache[current_manhattan--];
+                dist_patch[i * patch_memory_width + j] = val;
             }
             // half columns next to the first columns
             for (int j = S; j <= 2 * S; j++) {
-                uint16_t val = spatial_normalize_cache[current_manhattan++];
-                spatial_dist_patch[i * patch_memory_width + j] = val;
+                uint16_t val = normalize_cache[current_manhattan++];
+                dist_patch[i * patch_memory_width + j] = val;
+            }
+        }
+    }
+
+    ~SpatialPatch() {
+        simd_helper::free_aligned_array(dist_patch);
+        delete [] normalize_cache;
+    }
+
+    SpatialPatch(const SpatialPatch&) = delete;
+    SpatialPatch& operator=(const SpatialPatch&) = delete;
+
+    bool matches(int16_t S, float compactness, uint8_t quantize_level, bool volume) const {
+        return this->S == S && this->compactness == compactness && this->quantize_level == quantize_level && this->volume == volume;
+    }
+};
+
+// Process-wide LRU cache of spatial patches. Repeated iterations with the same parameters
+// (batches of same-sized images, small images) skip rebuilding them.
+class SpatialPatchCache {
+private:
+    std::mutex mutex;
+    // Most recently used first
+    std::list<std::shared_ptr<const SpatialPatch>> entries;
+    size_t capacity = 16;
+public:
+    std::shared_ptr<const SpatialPatch> get(int16_t S, float compactness, uint8_t quantize_level, bool volume = false) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = find(S, compactness, quantize_level, volume);
+            if (it != entries.end()) {
+                entries.splice(entries.begin(), entries, it);
+                return entries.front();
+            }
+        }
+
+        // Build outside the lock; contexts in use keep their patch alive through the shared_ptr
+        std::shared_ptr<const SpatialPatch> patch = std::make_shared<SpatialPatch>(S, compactness, quantize_level, volume);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = find(S, compactness, quantize_level, volume);
+        if (it != entries.end()) {
+            entries.splice(entries.begin(), entries, it);
+            return entries.front();
+        }
+        entries.push_front(patch);
+        if (entries.size() > capacity) entries.pop_back();
+        return patch;
+    }
+
+    void set_capacity(size_t capacity) {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->capacity = capacity;
+        while (entries.size() > capacity) entries.pop_back();
+    }
+private:
+    std::list<std::shared_ptr<const SpatialPatch>>::iterator find(int16_t S, float compactness, uint8_t quantize_level, bool volume) {
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if ((*it)->matches(S, compactness, quantize_level, volume)) return it;
+        }
+        return entries.end();
+    }
+};
+
+// Not static: every backend including this header shares the one instance.
+inline SpatialPatchCache& get_spatial_patch_cache() {
+    static SpatialPatchCache cache;
+    return cache;
+}
+
+class BaseContext {
+public:
+    int H, W, K;
+    // Volumes: number of H x W slices, the image and the assignment being [D, H, W]. 0 for plain images.
+    int D = 0;
+    int16_t S;
+    const char* algorithm;
+    float compactness;
+    float min_size_factor = 0.1;
+    uint8_t quantize_level;
+    Cluster* __restrict__ clusters;
+    const uint8_t* __restrict__ image = nullptr;
+    const uint16_t* __restrict__ spatial_dist_patch = nullptr;
+    const uint16_t* __restrict__ spatial_normalize_cache = nullptr;
+    uint32_t* __restrict__ assignment = nullptr;
+    // Adaptive density: half window size of each cluster in [1, S] (nullptr: S for all clusters).
+    // S is then the largest of them and sets the padding.
+    const uint16_t* __restrict__ cluster_S = nullptr;
+private:
+    std::shared_ptr<const SpatialPatch> spatial_patch;
+    // Adaptive density: patches indexed by half window size, only for the sizes in use
+    std::vector<std::shared_ptr<const SpatialPatch>> spatial_patches_by_S;
+
+public:
+    virtual ~BaseContext() {}
+
+    virtual void prepare_spatial() {
+        spatial_patch = get_spatial_patch_cache().get(S, compactness, quantize_level, D > 0);
+        spatial_normalize_cache = spatial_patch->normalize_cache;
+        spatial_dist_patch = spatial_patch->dist_patch;
+        if (cluster_S) {
+            spatial_patches_by_S.assign(S + 1, nullptr);
+            for (int k = 0; k < K; k++) {
+                uint16_t cluster_size = cluster_S[k];
+                if (!spatial_patches_by_S[cluster_size]) {
+                    spatial_patches_by_S[cluster_size] = get_spatial_patch_cache().get(cluster_size, compactness, quantize_level);
+                }
             }
         }
     }
+
+    // Spatial patch of the window of cluster k (normalized by its own S in adaptive mode)
+    const SpatialPatch* get_spatial_patch(int k) const {
+        return cluster_S ? spatial_patches_by_S[cluster_S[k]].get() : spatial_patch.get();
+    }
 };
 
 static uint32_t calc_z_order(uint16_t yPos, uint16_t xPos)
@@ -317,17 +430,21 @@ public:
     }
 };
 
-static void build_cc_set(ConnectedComponentSet &cc_set, const Cluster* clusters, int H, int W, uint32_t *assignment) {
+// Volumes (D > 1): the slices are stacked row after row, the first row of a slice having no row above it,
+// and each voxel is then linked to the one below it in the previous slice.
+static void build_cc_set(ConnectedComponentSet &cc_set, const Cluster* clusters, int H, int W, uint32_t *assignment, int D = 1) {
     std::vector<int> seam_ys;
     #pragma omp parallel
     {
         bool is_first = true;
         int seam = 0;
         #pragma omp for
-        for (int i = 0; i < H; i++) {
-            if (is_first) {
-                is_first = false;
-                seam = i;
+        for (int i = 0; i < D * H; i++) {
+            if (is_first || i % H == 0) {
+                if (is_first) {
+                    is_first = false;
+                    seam = i;
+                }
                 uint32_t left_cluster_no = assignment[i * W];
                 for (int j = 1; j < W; j++) {
                     int index = i * W + j;
@@ -397,7 +514,7 @@ static void build_cc_set(ConnectedComponentSet &cc_set, const Cluster* clusters,
     }
 
     for (int i : seam_ys) {
-        if (i <= 0) continue;
+        if (i % H == 0) continue;
         for (int j = 0; j < W; j++) {
             int index = i * W + j;
             int up_index = index - W;
@@ -409,19 +526,34 @@ static void build_cc_set(ConnectedComponentSet &cc_set, const Cluster* clusters,
             }
         }
     }
+
+    const int slice_size = H * W;
+    for (int index = slice_size; index < D * slice_size; index++) {
+        int below_index = index - slice_size;
+        uint32_t cluster_no = assignment[index];
+        if (assignment[below_index] == cluster_no) {
+            cc_set.merge(index, below_index);
+        } else if (cluster_no != 0xFFFF) {
+            cc_set.inform_adjacent_cluster(below_index, &clusters[cluster_no]);
+        }
+    }
 }
 
-static void merge_cc_set(ConnectedComponentSet &cc_set, const Cluster* clusters, int H, int W, uint32_t *assignment) {
+// Volumes (D > 1): the slices are stacked row after row, the first row of a slice having no row above it,
+// and each voxel is then linked to the one below it in the previous slice.
+static void merge_cc_set(ConnectedComponentSet &cc_set, const Cluster* clusters, int H, int W, uint32_t *assignment, int D = 1) {
     std::vector<int> seam_ys;
     #pragma omp parallel
     {
         bool is_first = true;
         int seam = 0;
         #pragma omp for
-        for (int i = 0; i < H; i++) {
-            if (is_first) {
-                is_first = false;
-                seam = i;
+        for (int i = 0; i < D * H; i++) {
+            if (is_first || i % H == 0) {
+                if (is_first) {
+                    is_first = false;
+                    seam = i;
+                }
                 uint32_t left_cluster_no = assignment[i * W];
                 for (int j = 1; j < W; j++) {
                     int index = i * W + j;
@@ -484,7 +616,7 @@ static void merge_cc_set(ConnectedComponentSet &cc_set, const Cluster* clusters,
     }
 
     for (int i : seam_ys) {
-        if (i <= 0) continue;
+        if (i % H == 0) continue;
         for (int j = 0; j < W; j++) {
             int index = i * W + j;
             int up_index = index - W;
@@ -498,6 +630,19 @@ static void merge_cc_set(ConnectedComponentSet &cc_set, const Cluster* clusters,
             }
         }
     }
+
+    const int slice_size = H * W;
+    for (int index = slice_size; index < D * slice_size; index++) {
+        int below_index = index - slice_size;
+        uint32_t cluster_no = assignment[index];
+        if (assignment[below_index] == 0xFFFF) {
+            if (cluster_no == 0xFFFF) {
+                cc_set.merge(below_index, index);
+            } else {
+                cc_set.inform_adjacent_cluster(below_index, &clusters[cluster_no]);
+            }
+        }
+    }
 }
 
 static void fast_remove_blob(BaseContext* context) {
@@ -506,23 +651,30 @@ static void fast_remove_blob(BaseContext* context) {
     int K = context->K;
     int S = context->S;
     if (K <= 0 || H <= 0 || W <= 0) return;
+    if (context->cluster_S) {
+        // Adaptive density: blobs are judged against the smallest superpixels
+        S = *std::min_element(context->cluster_S, context->cluster_S + K);
+    }
 
     const Cluster* clusters = context->clusters;
     uint32_t* assignment = context->assignment;
+    // Volumes: blobs are judged against the S^3 voxels of a supervoxel
+    const int D = my_max(context->D, 1);
+    const int size = D * H * W;
 
-    ConnectedComponentSet cc_set(H * W);
+    ConnectedComponentSet cc_set(size);
 
     // auto t1 = Clock::now();
-    build_cc_set(cc_set, clusters, H, W, assignment);
+    build_cc_set(cc_set, clusters, H, W, assignment, D);
     // auto t21 = Clock::now();
     std::shared_ptr<FlatCCSet> flat_cc = cc_set.flatten(assignment);
-    int thres = (int)round((double)(S * S) * (double)context->min_size_factor);
+    int thres = (int)round((double)(S * S) * (context->D > 0 ? (double)S : 1.0) * (double)context->min_size_factor);
 
     // auto t2 = Clock::now();
 
     // auto t3 = Clock::now();
     #pragma omp parallel for
-    for (int i = 0; i < H * W; i++) {
+    for (int i = 0; i < size; i++) {
         if (flat_cc->num_component_members[flat_cc->component_assignment[i]] < thres) {
             assignment[i] = 0xFFFF;
         }
@@ -530,7 +682,7 @@ static void fast_remove_blob(BaseContext* context) {
 
     // auto t4 = Clock::now();
     cc_set.clear_cluster_info();
-    merge_cc_set(cc_set, clusters, H, W, assignment);
+    merge_cc_set(cc_set, clusters, H, W, assignment, D);
     std::shared_ptr<FlatCCSet> flat_blank_cc = cc_set.flatten(assignment);
     // auto t5 = Clock::now();
 
@@ -546,7 +698,7 @@ static void fast_remove_blob(BaseContext* context) {
         }
 
         #pragma omp for
-        for (int i = 0; i < H * W; i++) {
+        for (int i = 0; i < size; i++) {
             uint32_t sub_cluster_no = sub_clsuter_nos[flat_blank_cc->component_assignment[i]];
             if (sub_cluster_no != 0xFFFF) {
                 assignment[i] = sub_cluster_no;
@@ -569,11 +721,13 @@ static void do_slic_enforce_connectivity_dfs(BaseContext *context) {
     const Cluster* clusters = context->clusters;
     uint32_t* assignment = context->assignment;
     if (K <= 0) return;
+    const int D = my_max(context->D, 1);
+    const int slice_size = H * W;
 
-    uint8_t *visited = new uint8_t[H * W];
-    std::fill_n(visited, H * W, 0);
+    uint8_t *visited = new uint8_t[D * slice_size];
+    std::fill_n(visited, D * slice_size, 0);
 
-    for (int i = 0; i < H; i++) {
+    for (int i = 0; i < D * H; i++) {
         for (int j = 0; j < W; j++) {
             int base_index = W * i + j;
             if (assignment[base_index] != 0xFFFF) continue;
@@ -596,16 +750,25 @@ static void do_slic_enforce_connectivity_dfs(BaseContext *context) {
                 visited_indices.push_back(index);
 
                 int index_j = index % W;
+                int slice_index = index % slice_size;
                 // up
-                if (index > W) {
+                if (slice_index > W) {
                     stack.push_back(index - W);
                 }
 
                 // down
-                if (index + W < H * W) {
+                if (slice_index + W < slice_size) {
                     stack.push_back(index + W);
                 }
 
+                // previous and next slices
+                if (index >= slice_size) {
+                    stack.push_back(index - slice_size);
+                }
+                if (index + slice_size < D * slice_size) {
+                    stack.push_back(index + slice_size);
+                }
+
                 // left
                 if (index_j > 0) {
                     stack.push_back(index - 1);
@@ -645,6 +808,94 @@ static void slic_enforce_connectivity(BaseContext *context) {
     }
 }
 
+// Deadline-bounded iterations (SlicOptions.time_budget_ms). An iteration only starts if it is expected to end,
+// together with the connectivity enforcement, within the budget. The first one always runs. The cost of an
+// iteration is the measured cost of the previous one. The enforcement cost per pixel is measured by each call
+// and reused by the next one given the same finish_ns_per_pixel (in a video, the previous frame), starting from a guess.
+class IterationDeadline {
+private:
+    typedef std::chrono::steady_clock SteadyClock;
+    float budget_ms;
+    size_t num_pixels;
+    // SlicOptions.finish_ns_per_pixel, may be nullptr
+    float* finish_ns_per_pixel;
+    SteadyClock::time_point start, iteration_start, update_start, finish_start;
+    double iteration_ms = 0, update_ms = -1;
+    // Set when the update step of the current iteration already prepared the next one (see allows_next)
+    bool next_committed = false;
+public:
+    int num_iterations = 0;
+
+    IterationDeadline(float budget_ms, size_t num_pixels, float* finish_ns_per_pixel)
+        : budget_ms(budget_ms), num_pixels(num_pixels), finish_ns_per_pixel(finish_ns_per_pixel), start(SteadyClock::now()) {}
+
+    bool bounded() const { return budget_ms > 0; }
+
+    // Starts the next iteration, or returns false if it would miss the deadline
+    bool begin_iteration() {
+        SteadyClock::time_point now = SteadyClock::now();
+        if (num_iterations > 0) {
+            iteration_ms = elapsed_ms(iteration_start, now);
+            if (bounded() && !next_committed && elapsed_ms(start, now) + iteration_ms + finish_ms() > budget_ms) return false;
+        }
+        next_committed = false;
+        iteration_start = now;
+        num_iterations++;
+        return true;
+    }
+
+    // Called between the assignment and the update of an iteration, for backends whose update prepares the next
+    // assignment: whether the rest of this iteration and a whole next one still fit. The answer binds the next
+    // begin_iteration. Until an update was measured, it is taken as long as the assignment.
+    bool allows_next() {
+        if (!bounded()) return true;
+        SteadyClock::time_point now = SteadyClock::now();
+        double assign_ms = elapsed_ms(iteration_start, now);
+        double rest_ms = (update_ms >= 0) ? update_ms : assign_ms;
+        next_committed = elapsed_ms(start, now) + rest_ms + (assign_ms + rest_ms) + finish_ms() <= budget_ms;
+        return next_committed;
+    }
+
+    void begin_update() { update_start = SteadyClock::now(); }
+    void end_update() { update_ms = elapsed_ms(update_start, SteadyClock::now()); }
+
+    void begin_finish() { finish_start = SteadyClock::now(); }
+    void end_finish() {
+        if (num_pixels > 0 && finish_ns_per_pixel != nullptr) {
+            *finish_ns_per_pixel = (float)(elapsed_ms(finish_start, SteadyClock::now()) * 1e6 / num_pixels);
+        }
+    }
+private:
+    static double elapsed_ms(SteadyClock::time_point from, SteadyClock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    double finish_ms() const {
+        const float ns_per_pixel = (finish_ns_per_pixel != nullptr && *finish_ns_per_pixel > 0) ? *finish_ns_per_pixel : 20.0f;
+        return ns_per_pixel * 1e-6 * num_pixels;
+    }
+};
+
+// Bounding box of the members of a cluster: [y_lo, y_hi) x [x_lo, x_hi). Empty if y_lo >= y_hi.
+struct ClusterBox {
+    int16_t y_lo, y_hi, x_lo, x_hi;
+};
+
+static void compute_cluster_boxes(int H, int W, int K, const uint32_t* assignment, std::vector<ClusterBox> &boxes) {
+    boxes.assign(K, ClusterBox { (int16_t)H, 0, (int16_t)W, 0 });
+    for (int i = 0; i < H; i++) {
+        for (int j = 0; j < W; j++) {
+            uint32_t cluster_no = assignment[W * i + j];
+            if (cluster_no >= (uint32_t)K) continue;
+            ClusterBox &box = boxes[cluster_no];
+            if (box.y_lo > i) box.y_lo = i;
+            if (box.y_hi <= i) box.y_hi = i + 1;
+            if (box.x_lo > j) box.x_lo = j;
+            if (box.x_hi <= j) box.x_hi = j + 1;
+        }
+    }
+}
+
 static void do_fast_slic_initialize_clusters(int H, int W, int K, const uint8_t* image, Cluster *clusters) {
     if (H <= 0 || W <= 0 || K <= 0) return;
     std::vector<int> gradients(H * W, 1 << 21);
@@ -730,5 +981,79 @@ static void do_fast_slic_initialize_clusters(int H, int W, int K, const uint8_t*
     }
 }
 
+// SNIC: simple non-iterative clustering (Achanta, Susstrunk. Superpixels and Polygons using Simple Non-Iterative Clustering. 2017).
+// Grows every seed at once from a priority queue, updating the centroids online. Each label is 4-connected
+// by construction, so no blob removal is needed. The distance is the SLIC one (L1 color + scaled manhattan).
+// The queue is a bucket queue over distances in steps of 4 color units, popped last in first out: a pixel pushed
+// below the current bucket goes into the current one. Coarser steps keep the pops closer to each other in the image
+// (about 25% faster than single color units on a 1545x2481 image at K=1600, for the same color error).
+static void do_fast_slic_snic(int H, int W, int K, float compactness, uint8_t quantize_level, const uint8_t* image, Cluster* clusters, uint32_t* assignment) {
+    if (H <= 0 || W <= 0 || K <= 0) return;
+    const int num_buckets = 1024, bucket_shift = quantize_level + 2;
+    const int S = my_max(1, (int)sqrt(H * W / K));
+    // spatial distance of one pixel, as in the normalize cache of prepare_spatial
+    const float spatial_scale = compactness * 25.5f / (2 * S) * (1 << quantize_level);
+
+    // 16-bit labels halve the random accesses of the region growing
+    std::vector<cluster_no_t> labels((size_t)H * W, 0xFFFF);
+    std::vector<int64_t> acc_vec((size_t)K * 5, 0); // sum of [y, x, r, g, b] in cluster
+    std::vector<uint32_t> num_members(K, 0);
+    // (pixel index << 16) | cluster number
+    std::vector<std::vector<uint64_t>> buckets(num_buckets);
+
+    for (int k = 0; k < K; k++) {
+        int y = my_min<int>(clusters[k].y, H - 1), x = my_min<int>(clusters[k].x, W - 1);
+        buckets[0].push_back(((uint64_t)((size_t)W * y + x) << 16) | (uint64_t)k);
+    }
 
+    for (int current = 0; current < num_buckets; current++) {
+        std::vector<uint64_t> &bucket = buckets[current];
+        while (!bucket.empty()) {
+            uint64_t entry = bucket.back();
+            bucket.pop_back();
+            uint32_t index = (uint32_t)(entry >> 16);
+            cluster_no_t k = (cluster_no_t)(entry & 0xFFFF);
+            if (labels[index] != 0xFFFF) continue;
+            labels[index] = k;
+
+            int y = (int)(index / (uint32_t)W), x = (int)(index - (uint32_t)y * W);
+            const uint8_t* rgb = &image[3 * index];
+            int64_t* acc = &acc_vec[5 * (size_t)k];
+            acc[0] += y;
+            acc[1] += x;
+            acc[2] += rgb[0];
+            acc[3] += rgb[1];
+            acc[4] += rgb[2];
+            // One division per pixel instead of five
+            const float inv_n = 1.0f / ++num_members[k];
+            const int cy = (int)(acc[0] * inv_n + 0.5f), cx = (int)(acc[1] * inv_n + 0.5f);
+            const int cr = (int)(acc[2] * inv_n + 0.5f), cg = (int)(acc[3] * inv_n + 0.5f), cb = (int)(acc[4] * inv_n + 0.5f);
+            const int ny[4] = {y - 1, y + 1, y, y}, nx[4] = {x, x, x - 1, x + 1};
+            for (int d = 0; d < 4; d++) {
+                if (ny[d] < 0 || ny[d] >= H || nx[d] < 0 || nx[d] >= W) continue;
+                uint32_t neighbor_index = (uint32_t)W * ny[d] + nx[d];
+                if (labels[neighbor_index] != 0xFFFF) continue;
+                const uint8_t* neighbor_rgb = &image[3 * neighbor_index];
+                uint32_t color_dist = (uint32_t)(fast_abs(neighbor_rgb[0] - cr) + fast_abs(neighbor_rgb[1] - cg) + fast_abs(neighbor_rgb[2] - cb)) << quantize_level;
+                uint32_t spatial_dist = (uint32_t)((fast_abs(ny[d] - cy) + fast_abs(nx[d] - cx)) * spatial_scale);
+                int key = my_max(current, my_min<int>(num_buckets - 1, (color_dist + spatial_dist) >> bucket_shift));
+                buckets[key].push_back(((uint64_t)neighbor_index << 16) | (uint64_t)k);
+            }
+        }
+        // Release the memory of the drained bucket
+        std::vector<uint64_t>().swap(bucket);
+    }
 
+    std::copy(labels.begin(), labels.end(), assignment);
+    for (int k = 0; k < K; k++) {
+        Cluster* cluster = &clusters[k];
+        uint32_t n = num_members[k];
+        cluster->num_members = n;
+        if (n == 0) continue;
+        cluster->y = (uint16_t)round_int<int64_t>(acc_vec[5 * k + 0], n);
+        cluster->x = (uint16_t)round_int<int64_t>(acc_vec[5 * k + 1], n);
+        cluster->r = (uint8_t)round_int<int64_t>(acc_vec[5 * k + 2], n);
+        cluster->g = (uint8_t)round_int<int64_t>(acc_vec[5 * k + 3], n);
+        cluster->b = (uint8_t)round_int<int64_t>(acc_vec[5 * k + 4], n);
+    }
+}
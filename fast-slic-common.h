@@ -11,7 +11,7 @@ typedef struct Cluster {
     uint8_t r;
     uint8_t g;
     uint8_t b;
-    // 1 byte dummy data
+    // 1 byte dummy data (the quantized mean depth in RGB-D mode)
     uint8_t reserved[1];
 
     cluster_no_t number; // 2 bytes
@@ -26,4 +26,73 @@ typedef struct Connectivity {
     uint32_t **neighbors;
 } Connectivity;
 
+// Optional knobs of fast_slic_iterate_ex / fast_slic_iterate_avx2_ex.
+// A zero-filled struct keeps the default behavior of fast_slic_iterate.
+typedef struct SlicOptions {
+    // Incremental mode (avx2 only): the reference frame, uint8_t[H, W, 3], i.e. the frame each tile's labels
+    // were last computed on (the previous fully processed frame, updated by the incremental calls since).
+    // assignment must hold the labels of the previous frame on entry.
+    // Only clusters whose windows touch changed tiles are re-run, and the changed tiles of prev_image are
+    // overwritten with the current frame on return, so that slow drifts add up to a change.
+    uint8_t* prev_image;
+    // Mean absolute difference per channel above which a tile counts as changed (default 3)
+    float incremental_threshold;
+    // Pyramid mode (avx2 only): number of 2x downsamplings (1 or 2, 0 to disable).
+    // All but the last one or two iterations run on the downsampled image; the rest only
+    // re-assign the pixels near the upsampled boundaries at full resolution.
+    int pyramid_levels;
+    // Boundary-band mode (avx2 only): iterations from band_start_iter (>= 1, 0 to disable) on
+    // re-evaluate only the pixels within band_width (default 2, at most 8) of a label boundary,
+    // then of a pixel whose label changed in the previous iteration.
+    int band_start_iter;
+    int band_width;
+    // Bounds mode (avx2 only): iterations from bound_start_iter (>= 1, 0 to disable) on skip the pixel rows
+    // whose distance bounds prove that no cluster can take them over. The labels are the same as without it.
+    int bound_start_iter;
+    // Subsampled mode (avx2 only): the first subsample_iters iterations assign and average every other
+    // pixel row only (0 to disable). The last iteration always runs at full resolution.
+    int subsample_iters;
+    // Extent mode (avx2 only): from the third iteration on, the cluster-oriented kernel clips the window of
+    // each cluster to its member bounding box in the previous iteration grown by extent_margin pixels
+    // (0 to disable; about 8 keeps the quality). Not combined with the incremental, pyramid and tiled modes.
+    int extent_margin;
+    // Assignment kernel (avx2 only): "cluster_oriented" (nullptr, the default) scans the window of each cluster;
+    // "tiled" stores the image and the labels in 64x16 pixel tiles and walks the windows tile by tile
+    // (not combined with the band and bounds modes).
+    // "snic" (both backends) replaces the iterations and the blob removal with one pass of priority-queue
+    // region growing from the initial clusters; max_iter and min_size_factor are ignored.
+    // "seeds" (avx2 only) refines a regular grid by moving blocks, then pixels, between neighboring superpixels
+    // by color histogram (half of max_iter each); compactness, quantize_level and min_size_factor are ignored.
+    const char* algorithm;
+    // Adaptive density: half window size of each cluster (K entries, from fast_slic_initialize_clusters_adaptive),
+    // nullptr for the regular S. Only the cluster-oriented kernels support it; the avx2 backend ignores
+    // the pyramid, band, bounds and algorithm options with it.
+    const uint16_t* cluster_S;
+    // RGB-D mode (avx2 only): depth map aligned with the image, float[H, W], nullptr to disable.
+    // min(255, depth * depth_weight) joins the L1 color distance as a fourth channel (in the padding byte of
+    // the color quads, at no extra cost). Only the cluster-oriented kernel supports it, as with cluster_S.
+    const float* depth;
+    float depth_weight;
+    // Saturation telemetry (avx2 only): receives the number of candidate distances clamped to 65535 by the
+    // cluster-oriented kernel, summed over the iterations (nullptr to skip counting). Left untouched when the
+    // call runs another kernel or band or bounds iterations, which cannot count. Saturated candidates
+    // tie and go to the lowest cluster number; fast_slic_auto_quantize_level picks a level that avoids them.
+    uint64_t* num_saturated;
+    // Time budget of the whole call in milliseconds, 0 for none. The iterations stop early when the next one is
+    // not expected to finish, together with the connectivity enforcement, within the budget (the first one
+    // always runs); see IterationDeadline.
+    float time_budget_ms;
+    // In and out, nullptr for none: the connectivity enforcement cost per pixel in ns measured by the last call,
+    // which the deadline of this one assumes (0 for a fixed guess). It depends on the backend and the image,
+    // so keep one per model or stream.
+    float* finish_ns_per_pixel;
+    // Receives the number of iterations that ran (nullptr to skip), including the coarse pyramid ones.
+    // 0 when snic, seeds or an unchanged incremental frame replace the iterations.
+    int* num_iterations;
+} SlicOptions;
+
+// Flags of temporal cluster association
+#define FAST_SLIC_ASSOC_SPLIT 1 // the matched previous cluster is also matched by other current clusters
+#define FAST_SLIC_ASSOC_MERGE 2 // several previous clusters are closest to this cluster
+
 #endif
@@ -1,4 +1,7 @@
 #include <utility>
+#include <queue>
+#include <tuple>
+#include <functional>
 #include "fast-slic.h"
 #include "fast-slic-common-impl.hpp"
 
@@ -20,7 +23,6 @@ static void slic_assign_cluster_oriented(Context *context) {
     auto image = context->image;
     auto assignment = context->assignment;
     auto quantize_level = context->quantize_level;
-    auto spatial_normalize_cache = context->spatial_normalize_cache;
 
     const int16_t S = context->S;
 
@@ -60,8 +62,11 @@ static void slic_assign_cluster_oriented(Context *context) {
 
         int16_t cluster_y = cluster->y;
         int16_t cluster_x = cluster->x;
-        const int16_t y_lo = my_max<int16_t>(0, cluster_y - S), y_hi = my_min<int16_t>(H, cluster_y + S + 1);
-        const int16_t x_lo = my_max<int16_t>(0, cluster_x - S), x_hi = my_min<int16_t>(W, cluster_x + S + 1);
+        // Adaptive density: window and spatial scale of the cluster's own size
+        const int16_t cluster_S = context->cluster_S ? context->cluster_S[cluster->number] : S;
+        const uint16_t* spatial_normalize_cache = context->get_spatial_patch(cluster->number)->normalize_cache;
+        const int16_t y_lo = my_max<int16_t>(0, cluster_y - cluster_S), y_hi = my_min<int16_t>(H, cluster_y + cluster_S + 1);
+        const int16_t x_lo = my_max<int16_t>(0, cluster_x - cluster_S), x_hi = my_min<int16_t>(W, cluster_x + cluster_S + 1);
 
         uint16_t row_first_manhattan = (cluster_y - y_lo) + (cluster_x - x_lo);
         for (int16_t i = y_lo; i < cluster_y; i++) {
@@ -206,12 +211,198 @@ static void slic_update_clusters(Context *context) {
     delete [] cluster_acc_vec;
 }
 
+// Content-adaptive seeding: places the K seeds so that each covers about the same mass of a detail map, and
+// gives each cluster a half window size S matching its cell. The map is the given density (float [H, W]) or,
+// if nullptr, the gradient energy of the image plus its mean, so that flat regions keep about half the average
+// density. The sizes are rounded to steps of S / 8 of the regular grid to share few spatial patches.
+static void do_fast_slic_initialize_clusters_adaptive(int H, int W, int K, const uint8_t* image, const float* density, Cluster *clusters, uint16_t* cluster_S) {
+    if (H <= 0 || W <= 0 || K <= 0) return;
+    const int S = my_max(1, (int)sqrt(H * W / K));
+    // Rows and columns of cells in the aspect ratio of the image, so that the cells are about S x S
+    const int n_y = my_min(K, my_max(1, (int)round(sqrt((double)K * H / W))));
+    std::vector<int> n_xs(n_y, K / n_y);
+    for (int i = 0; i < K % n_y; i++) n_xs[i]++;
+    if (H < n_y || W < *std::max_element(n_xs.begin(), n_xs.end())) {
+        // Too small to split by mass
+        do_fast_slic_initialize_clusters(H, W, K, image, clusters);
+        std::fill_n(cluster_S, K, (uint16_t)S);
+        return;
+    }
+
+    std::vector<float> detail((size_t)H * W);
+    if (density) {
+        for (size_t i = 0; i < (size_t)H * W; i++) detail[i] = my_max(0.0f, density[i]);
+    } else {
+        #pragma omp parallel
+        {
+            // Per channel |right - left| + |down - up|, in a form the compiler vectorizes
+            std::vector<uint16_t> energy(3 * W);
+            #pragma omp for
+            for (int i = 0; i < H; i++) {
+                const uint8_t* row = &image[(size_t)3 * W * i];
+                const uint8_t* up = (i > 0) ? row - 3 * W : row;
+                const uint8_t* down = (i < H - 1) ? row + 3 * W : row;
+                for (int c = 0; c < 3 * W; c++) {
+                    energy[c] = (uint16_t)fast_abs((int)down[c] - (int)up[c]);
+                }
+                for (int c = 3; c < 3 * W - 3; c++) {
+                    energy[c] += (uint16_t)fast_abs((int)row[c + 3] - (int)row[c - 3]);
+                }
+                for (int j = 0; j < W; j++) {
+                    detail[(size_t)W * i + j] = (float)(energy[3 * j] + energy[3 * j + 1] + energy[3 * j + 2]);
+                }
+            }
+        }
+        double mean = 0;
+        for (size_t i = 0; i < (size_t)H * W; i++) mean += detail[i];
+        mean /= (double)H * W;
+        for (size_t i = 0; i < (size_t)H * W; i++) detail[i] += (float)mean;
+    }
+
+    // Splits [0, n) into num_parts ranges of about equal mass, each at least one long
+    auto split_by_mass = [](const std::vector<double> &mass, int num_parts, std::vector<int> &bounds) {
+        const int n = (int)mass.size();
+        double total = 0;
+        for (double m : mass) total += m;
+        bounds.assign(num_parts + 1, n);
+        bounds[0] = 0;
+        double acc = 0;
+        int pos = 0;
+        for (int part = 1; part < num_parts; part++) {
+            const double target = total * part / num_parts;
+            while (pos < n && acc + mass[pos] <= target) acc += mass[pos++];
+            bounds[part] = my_min(my_max(pos, bounds[part - 1] + 1), n - (num_parts - part));
+            while (pos < bounds[part]) acc += mass[pos++];
+            while (pos > bounds[part]) acc -= mass[--pos];
+        }
+    };
+
+    std::vector<double> row_mass(H, 0.0);
+    for (int i = 0; i < H; i++) {
+        for (int j = 0; j < W; j++) row_mass[i] += detail[(size_t)W * i + j];
+    }
+    std::vector<int> y_bounds, x_bounds;
+    split_by_mass(row_mass, n_y, y_bounds);
+
+    const int size_step = my_max(1, S / 8);
+    int k = 0;
+    std::vector<double> col_mass(W);
+    for (int strip = 0; strip < n_y; strip++) {
+        const int y0 = y_bounds[strip], y1 = y_bounds[strip + 1];
+        std::fill(col_mass.begin(), col_mass.end(), 0.0);
+        for (int i = y0; i < y1; i++) {
+            for (int j = 0; j < W; j++) col_mass[j] += detail[(size_t)W * i + j];
+        }
+        split_by_mass(col_mass, n_xs[strip], x_bounds);
+        for (int cell = 0; cell < n_xs[strip]; cell++, k++) {
+            const int x0 = x_bounds[cell], x1 = x_bounds[cell + 1];
+            Cluster* cluster = &clusters[k];
+            cluster->y = (y0 + y1) / 2;
+            cluster->x = (x0 + x1) / 2;
+            const uint8_t* rgb = &image[3 * ((size_t)W * cluster->y + cluster->x)];
+            cluster->r = rgb[0];
+            cluster->g = rgb[1];
+            cluster->b = rgb[2];
+            cluster->number = k;
+            cluster->num_members = 0;
+            int cell_S = round_int(my_max(y1 - y0, x1 - x0), size_step) * size_step;
+            cluster_S[k] = (uint16_t)my_min(my_max(cell_S, 2), 2 * S);
+        }
+    }
+}
+
+// 3-D seed lattice: the volume is cut into layers of about S slices (S = cbrt(D * H * W / K)),
+// and the clusters of each layer are seeded on its middle slice like on an image.
+// cluster_z receives the slice of each cluster.
+static void do_fast_slic_initialize_clusters_3d(int D, int H, int W, int K, const uint8_t* image, Cluster *clusters, uint16_t* cluster_z) {
+    if (D <= 0 || H <= 0 || W <= 0 || K <= 0) return;
+    const double S = cbrt((double)D * H * W / K);
+    const int n_z = my_max(1, my_min(my_min(D, K), (int)round(D / S)));
+
+    int acc_k = 0;
+    for (int layer = 0; layer < n_z; layer++) {
+        const int z_lo = layer * D / n_z, z_hi = (layer + 1) * D / n_z;
+        const int z = (z_lo + z_hi) / 2;
+        const int layer_K = K / n_z + (layer < K % n_z ? 1 : 0);
+        do_fast_slic_initialize_clusters(H, W, layer_K, &image[(size_t)z * H * W * 3], &clusters[acc_k]);
+        for (int k = acc_k; k < acc_k + layer_K; k++) {
+            clusters[k].number = k;
+            cluster_z[k] = z;
+        }
+        acc_k += layer_K;
+    }
+}
+
+// Sum of the channel ranges (max - min) of a packed RGB image: the largest color distance between two of its pixels
+static int find_color_range(int H, int W, const uint8_t* image) {
+    uint8_t lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+    #pragma omp parallel
+    {
+        uint8_t local_lo[3] = {255, 255, 255}, local_hi[3] = {0, 0, 0};
+        #pragma omp for
+        for (int i = 0; i < H; i++) {
+            const uint8_t* row = &image[(size_t)W * 3 * i];
+            for (int j = 0; j < W; j++) {
+                for (int c = 0; c < 3; c++) {
+                    local_lo[c] = my_min(local_lo[c], row[3 * j + c]);
+                    local_hi[c] = my_max(local_hi[c], row[3 * j + c]);
+                }
+            }
+        }
+        #pragma omp critical
+        for (int c = 0; c < 3; c++) {
+            lo[c] = my_min(lo[c], local_lo[c]);
+            hi[c] = my_max(hi[c], local_hi[c]);
+        }
+    }
+
+    int color_range = 0;
+    for (int c = 0; c < 3; c++) {
+        if (hi[c] > lo[c]) color_range += hi[c] - lo[c];
+    }
+    return color_range;
+}
+
+// Highest quantize_level (at most 15) under which no distance of the image can saturate 16 bits.
+// The worst case is the sum of the channel ranges of the image plus the spatial term of a window corner,
+// compactness * 25.5 whatever S is, both shifted by quantize_level. 0 if even that overflows.
+static uint8_t do_fast_slic_auto_quantize_level(int H, int W, float compactness, const uint8_t* image) {
+    const int color_range = find_color_range(H, W, image);
+    for (int quantize_level = 15; quantize_level > 0; quantize_level--) {
+        double max_dist = (double)(color_range << quantize_level) + (double)compactness * 25.5 * (1 << quantize_level);
+        if (max_dist <= 65535) return quantize_level;
+    }
+    return 0;
+}
+
 extern "C" {
     void fast_slic_initialize_clusters(int H, int W, int K, const uint8_t* image, Cluster *clusters) {
         do_fast_slic_initialize_clusters(H, W, K, image, clusters);
     }
 
+    void fast_slic_initialize_clusters_adaptive(int H, int W, int K, const uint8_t* image, const float* density, Cluster *clusters, uint16_t* cluster_S) {
+        do_fast_slic_initialize_clusters_adaptive(H, W, K, image, density, clusters, cluster_S);
+    }
+
+    uint8_t fast_slic_auto_quantize_level(int H, int W, float compactness, const uint8_t* image) {
+        return do_fast_slic_auto_quantize_level(H, W, compactness, image);
+    }
+
+    void fast_slic_initialize_clusters_3d(int D, int H, int W, int K, const uint8_t* image, Cluster *clusters, uint16_t* cluster_z) {
+        do_fast_slic_initialize_clusters_3d(D, H, W, K, image, clusters, cluster_z);
+    }
+
     void fast_slic_iterate(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment) {
+        fast_slic_iterate_ex(H, W, K, compactness, min_size_factor, quantize_level, max_iter, image, clusters, assignment, nullptr);
+    }
+
+    void fast_slic_iterate_ex(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment, const SlicOptions* options) {
+        // Incremental mode is only implemented by the avx2 backend; this one always runs a full pass.
+        if (options != nullptr && options->algorithm != nullptr && !strcmp(options->algorithm, "snic")) {
+            do_fast_slic_snic(H, W, K, compactness, quantize_level, image, clusters, assignment);
+            if (options->num_iterations != nullptr) *options->num_iterations = 0;
+            return;
+        }
 
         Context context;
         context.image = image;
@@ -220,6 +411,10 @@ extern "C" {
         context.W = W;
         context.K = K;
         context.S = (int16_t)sqrt(H * W / K);
+        if (options != nullptr && options->cluster_S != nullptr) {
+            context.cluster_S = options->cluster_S;
+            context.S = *std::max_element(options->cluster_S, options->cluster_S + K);
+        }
         context.compactness = compactness;
         context.min_size_factor = min_size_factor;
         context.quantize_level = quantize_level;
@@ -228,7 +423,9 @@ extern "C" {
 
         context.prepare_spatial();
 
+        IterationDeadline deadline(options != nullptr ? options->time_budget_ms : 0, (size_t)H * W, options != nullptr ? options->finish_ns_per_pixel : nullptr);
         for (int i = 0; i < max_iter; i++) {
+            if (!deadline.begin_iteration()) break;
             // auto t1 = Clock::now();
             slic_assign(&context);
             // auto t2 = Clock::now();
@@ -239,8 +436,11 @@ extern "C" {
         }
 
         // auto t1 = Clock::now();
+        deadline.begin_finish();
         slic_enforce_connectivity(&context);
+        deadline.end_finish();
         // auto t2 = Clock::now();
+        if (options != nullptr && options->num_iterations != nullptr) *options->num_iterations = deadline.num_iterations;
 
         // std::cerr << "enforce connectivity "<< std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count() << "us \n";
     }
@@ -370,6 +570,227 @@ extern "C" {
         return conn;
     }
 
+    // merges: int32_t[] of shape [K - 1, 2], distances: float[K - 1].
+    // Agglomerates adjacent superpixels by Ward's criterion on their mean colors:
+    // n_a * n_b / (n_a + n_b) * |mean_a - mean_b|^2.
+    // Merge i joins nodes merges[i] into node K + i; nodes below K are the superpixels, as in a scipy linkage matrix.
+    // Returns the number of merges, fewer than K - 1 if the adjacency graph is not connected or labels are unused.
+    int fast_slic_build_hierarchy(int H, int W, int K, const uint8_t* image, const uint32_t* assignment, int32_t* merges, float* distances) {
+        if (H <= 0 || W <= 0 || K <= 1) return 0;
+        const int num_nodes = 2 * K - 1;
+        std::vector<int64_t> acc_vec((size_t)num_nodes * 3, 0); // sum of [r, g, b] in node
+        std::vector<int64_t> num_node_members(num_nodes, 0);
+        std::vector<uint64_t> edges; // (min label << 32) | max label
+        for (int i = 0; i < H; i++) {
+            for (int j = 0; j < W; j++) {
+                int base_index = W * i + j;
+                uint32_t label = assignment[base_index];
+                if (label >= (uint32_t)K) continue;
+                num_node_members[label]++;
+                acc_vec[3 * label + 0] += image[3 * base_index];
+                acc_vec[3 * label + 1] += image[3 * base_index + 1];
+                acc_vec[3 * label + 2] += image[3 * base_index + 2];
+                uint32_t right = (j + 1 < W) ? assignment[base_index + 1] : label;
+                uint32_t down = (i + 1 < H) ? assignment[base_index + W] : label;
+                if (right != label && right < (uint32_t)K) edges.push_back(((uint64_t)my_min(label, right) << 32) | my_max(label, right));
+                if (down != label && down < (uint32_t)K) edges.push_back(((uint64_t)my_min(label, down) << 32) | my_max(label, down));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        // Neighbor lists keep stale entries of merged nodes; they are skipped when read
+        std::vector<std::vector<int>> neighbors(num_nodes);
+        for (uint64_t edge : edges) {
+            int a = (int)(edge >> 32), b = (int)(edge & 0xFFFFFFFF);
+            neighbors[a].push_back(b);
+            neighbors[b].push_back(a);
+        }
+        std::vector<uint8_t> alive(num_nodes, 0);
+        for (int k = 0; k < K; k++) alive[k] = num_node_members[k] > 0;
+
+        auto merge_cost = [&](int a, int b) {
+            double n_a = (double)num_node_members[a], n_b = (double)num_node_members[b];
+            double dist = 0;
+            for (int c = 0; c < 3; c++) {
+                double diff = acc_vec[3 * a + c] / n_a - acc_vec[3 * b + c] / n_b;
+                dist += diff * diff;
+            }
+            return (float)(n_a * n_b / (n_a + n_b) * dist);
+        };
+
+        // Min-heap of (cost, a, b) with lazy deletion of the pairs whose nodes were merged
+        typedef std::tuple<float, int, int> Candidate;
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> heap;
+        for (uint64_t edge : edges) {
+            int a = (int)(edge >> 32), b = (int)(edge & 0xFFFFFFFF);
+            heap.push(Candidate(merge_cost(a, b), a, b));
+        }
+
+        int num_merges = 0;
+        while (!heap.empty() && num_merges < K - 1) {
+            Candidate top = heap.top();
+            heap.pop();
+            int a = std::get<1>(top), b = std::get<2>(top);
+            if (!alive[a] || !alive[b]) continue;
+
+            const int node = K + num_merges;
+            merges[2 * num_merges] = a;
+            merges[2 * num_merges + 1] = b;
+            distances[num_merges] = std::get<0>(top);
+            num_merges++;
+
+            alive[a] = alive[b] = 0;
+            alive[node] = 1;
+            num_node_members[node] = num_node_members[a] + num_node_members[b];
+            for (int c = 0; c < 3; c++) acc_vec[3 * node + c] = acc_vec[3 * a + c] + acc_vec[3 * b + c];
+
+            std::vector<int> &node_neighbors = neighbors[node];
+            for (int source : {a, b}) {
+                for (int neighbor : neighbors[source]) {
+                    if (!alive[neighbor] || neighbor == node) continue;
+                    if (std::find(node_neighbors.begin(), node_neighbors.end(), neighbor) != node_neighbors.end()) continue;
+                    node_neighbors.push_back(neighbor);
+                    neighbors[neighbor].push_back(node);
+                    heap.push(Candidate(merge_cost(node, neighbor), node, neighbor));
+                }
+                std::vector<int>().swap(neighbors[source]);
+            }
+        }
+        return num_merges;
+    }
+
+    // labels: uint32_t[K], region of each superpixel after the merges that leave num_regions regions
+    // (or all num_merges of them). Regions are numbered 0, 1, ... in the order of their smallest superpixel.
+    void fast_slic_cut_hierarchy(int K, int num_merges, const int32_t* merges, int num_regions, uint32_t* labels) {
+        if (K <= 0) return;
+        const int num_applied = my_max(0, my_min(num_merges, K - num_regions));
+        std::vector<int> parent(K + num_applied);
+        for (int node = 0; node < K + num_applied; node++) parent[node] = node;
+        for (int i = 0; i < num_applied; i++) {
+            parent[merges[2 * i]] = parent[merges[2 * i + 1]] = K + i;
+        }
+        std::vector<uint32_t> region_of_root(K + num_applied, 0xFFFFFFFF);
+        uint32_t num_found = 0;
+        for (int k = 0; k < K; k++) {
+            int root = k;
+            while (parent[root] != root) root = parent[root];
+            // Path compression for the superpixels below the same root
+            for (int node = k; parent[node] != root; ) {
+                int next = parent[node];
+                parent[node] = root;
+                node = next;
+            }
+            if (region_of_root[root] == 0xFFFFFFFF) region_of_root[root] = num_found++;
+            labels[k] = region_of_root[root];
+        }
+    }
+
+    // motion: int16_t[] of shape [K, 2], displacement (dy, dx) of each cluster between the frames
+    void fast_slic_estimate_motion(int H, int W, int K, const uint8_t* prev_image, const uint8_t* image, const uint32_t* prev_assignment, int search_radius, int16_t* motion) {
+        if (H <= 0 || W <= 0 || K <= 0) return;
+        std::vector<ClusterBox> boxes;
+        compute_cluster_boxes(H, W, K, prev_assignment, boxes);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int k = 0; k < K; k++) {
+            const ClusterBox &box = boxes[k];
+            motion[2 * k] = motion[2 * k + 1] = 0;
+            if (box.y_lo >= box.y_hi) continue;
+
+            // Every displacement within the radius is searched. Members that leave the image do not count,
+            // so the scores are mean absolute differences over the members still inside; (0, 0) wins ties.
+            const int r = my_max(search_radius, 0), num_dx = 2 * r + 1;
+            uint64_t min_sad = 0, min_count = 0;
+            for (int d = -1; d < num_dx * num_dx; d++) {
+                int dy = (d < 0) ? 0 : d / num_dx - r;
+                int dx = (d < 0) ? 0 : d % num_dx - r;
+                const int i_lo = my_max((int)box.y_lo, -dy), i_hi = my_min((int)box.y_hi, H - dy);
+                const int j_lo = my_max((int)box.x_lo, -dx), j_hi = my_min((int)box.x_hi, W - dx);
+                uint64_t sad = 0, count = 0;
+                for (int i = i_lo; i < i_hi; i++) {
+                    for (int j = j_lo; j < j_hi; j++) {
+                        if (prev_assignment[W * i + j] != (uint32_t)k) continue;
+                        const uint8_t* prev_pixel = prev_image + 3 * (W * i + j);
+                        const uint8_t* pixel = image + 3 * (W * (i + dy) + (j + dx));
+                        sad += fast_abs<int>((int)prev_pixel[0] - (int)pixel[0]) +
+                            fast_abs<int>((int)prev_pixel[1] - (int)pixel[1]) +
+                            fast_abs<int>((int)prev_pixel[2] - (int)pixel[2]);
+                        count++;
+                    }
+                }
+                if (count > 0 && (min_count == 0 || sad * min_count < min_sad * count)) {
+                    min_sad = sad;
+                    min_count = count;
+                    motion[2 * k] = dy;
+                    motion[2 * k + 1] = dx;
+                }
+            }
+        }
+    }
+
+    static void find_nearest_clusters(int H, int W, int K_from, const Cluster* from_clusters, int K_to, const Cluster* to_clusters, float color_weight, int32_t* nearest) {
+        int S = my_max((int)sqrt(H * W / my_max(K_to, 1)), 1);
+        int nh = ceil_int(H, S), nw = ceil_int(W, S);
+
+        std::vector< std::vector<const Cluster*> > s_cells(nh * nw);
+        for (int i = 0; i < K_to; i++) {
+            const Cluster* cluster = to_clusters + i;
+            if (cluster->num_members == 0) continue;
+            int cy = my_min(cluster->y / S, nh - 1), cx = my_min(cluster->x / S, nw - 1);
+            s_cells[cy * nw + cx].push_back(cluster);
+        }
+
+        #pragma omp parallel for
+        for (int i = 0; i < K_from; i++) {
+            const Cluster* cluster = from_clusters + i;
+            nearest[i] = -1;
+            if (cluster->num_members == 0) continue;
+            int cell_center_y = cluster->y / S, cell_center_x = cluster->x / S;
+            float min_cost = 0;
+            for (int cy = my_max(cell_center_y - 2, 0); cy < my_min(nh, cell_center_y + 3); cy++) {
+                for (int cx = my_max(cell_center_x - 2, 0); cx < my_min(nw, cell_center_x + 3); cx++) {
+                    for (const Cluster* cluster_around : s_cells[cy * nw + cx]) {
+                        int spatial_dist = fast_abs(cluster_around->x - cluster->x) + fast_abs(cluster_around->y - cluster->y);
+                        int color_dist = fast_abs(cluster_around->r - cluster->r) + fast_abs(cluster_around->g - cluster->g) + fast_abs(cluster_around->b - cluster->b);
+                        float cost = spatial_dist + color_weight * color_dist;
+                        if (nearest[i] < 0 || cost < min_cost) {
+                            nearest[i] = (int32_t)(cluster_around - to_clusters);
+                            min_cost = cost;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void fast_slic_associate_clusters(int H, int W, int K_prev, const Cluster* prev_clusters, int K, const Cluster* clusters, float color_weight, int32_t* correspondence, uint8_t* flags) {
+        if (H <= 0 || W <= 0 || K <= 0) return;
+        std::fill_n(flags, K, 0);
+        if (K_prev <= 0) {
+            std::fill_n(correspondence, K, -1);
+            return;
+        }
+
+        // forward: current -> previous, backward: previous -> current
+        std::vector<int32_t> backward(K_prev);
+        find_nearest_clusters(H, W, K, clusters, K_prev, prev_clusters, color_weight, correspondence);
+        find_nearest_clusters(H, W, K_prev, prev_clusters, K, clusters, color_weight, backward.data());
+
+        std::vector<int> num_forward_matches(K_prev, 0), num_backward_matches(K, 0);
+        for (int k = 0; k < K; k++) {
+            if (correspondence[k] >= 0) num_forward_matches[correspondence[k]]++;
+        }
+        for (int k = 0; k < K_prev; k++) {
+            if (backward[k] >= 0) num_backward_matches[backward[k]]++;
+        }
+
+        for (int k = 0; k < K; k++) {
+            if (correspondence[k] >= 0 && num_forward_matches[correspondence[k]] > 1) flags[k] |= FAST_SLIC_ASSOC_SPLIT;
+            if (num_backward_matches[k] > 1) flags[k] |= FAST_SLIC_ASSOC_MERGE;
+        }
+    }
+
     void fast_slic_free_connectivity(Connectivity* conn) {
         delete [] conn->num_neighbors;
         for (int i = 0; i < conn->num_nodes; i++) {
@@ -9,11 +9,19 @@
 extern "C" {
 #endif
     void fast_slic_initialize_clusters(int H, int W, int K, const uint8_t* image, Cluster *clusters);
+    void fast_slic_initialize_clusters_adaptive(int H, int W, int K, const uint8_t* image, const float* density, Cluster *clusters, uint16_t* cluster_S);
+    uint8_t fast_slic_auto_quantize_level(int H, int W, float compactness, const uint8_t* image);
+    void fast_slic_initialize_clusters_3d(int D, int H, int W, int K, const uint8_t* image, Cluster *clusters, uint16_t* cluster_z);
     void fast_slic_iterate(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment);
+    void fast_slic_iterate_ex(int H, int W, int K, float compactness, float min_size_factor, uint8_t quantize_level, int max_iter, const uint8_t* image, Cluster* clusters, uint32_t* assignment, const SlicOptions* options);
 #ifdef __cplusplus
     Connectivity* fast_slic_get_connectivity(int H, int W, int K, const uint32_t *assignment);
     Connectivity* fast_slic_knn_connectivity(int H, int W, int K, const Cluster* clusters, size_t num_neighbors);
     void fast_slic_free_connectivity(Connectivity* conn);
+    void fast_slic_estimate_motion(int H, int W, int K, const uint8_t* prev_image, const uint8_t* image, const uint32_t* prev_assignment, int search_radius, int16_t* motion);
+    void fast_slic_associate_clusters(int H, int W, int K_prev, const Cluster* prev_clusters, int K, const Cluster* clusters, float color_weight, int32_t* correspondence, uint8_t* flags);
+    int fast_slic_build_hierarchy(int H, int W, int K, const uint8_t* image, const uint32_t* assignment, int32_t* merges, float* distances);
+    void fast_slic_cut_hierarchy(int K, int num_merges, const int32_t* merges, int num_regions, uint32_t* labels);
     void fast_slic_get_mask_density(int H, int W, int K, const Cluster* clusters, const uint32_t* assignment, const uint8_t *mask, uint8_t *cluster_densities);
     void fast_slic_cluster_density_to_mask(int H, int W, int K, const Cluster *clusters, const uint32_t* assignment, const uint8_t *cluster_densities, uint8_t *result);
 }
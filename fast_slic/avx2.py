@@ -1,5 +1,5 @@
 from cfast_slic import SlicModelAvx2, slic_supports_arch
-from .base_slic import BaseSlic
+from .base_slic import BaseSlic, as_image
 
 if not slic_supports_arch("avx2"):
     raise ImportError(
@@ -8,15 +8,36 @@ if not slic_supports_arch("avx2"):
     )
 
 class SlicAvx2(BaseSlic):
-    def __init__(self, num_components=None, slic_model=None, compactness=10, min_size_factor=0.05, quantize_level=6):
+    def __init__(self, num_components=None, slic_model=None, compactness=10, min_size_factor=0.05, quantize_level=6, incremental=False, motion_search_radius=0, pyramid_levels=0, band_start_iter=0, bound_start_iter=0, subsample_iters=0, algorithm=None, adaptive_density=False, depth_weight=1.0, count_saturation=False, time_budget_ms=0, extent_margin=0):
         super().__init__(
             num_components=num_components,
             slic_model=slic_model,
             compactness=compactness,
             min_size_factor=min_size_factor,
             quantize_level=quantize_level,
+            incremental=incremental,
+            motion_search_radius=motion_search_radius,
+            pyramid_levels=pyramid_levels,
+            band_start_iter=band_start_iter,
+            bound_start_iter=bound_start_iter,
+            subsample_iters=subsample_iters,
+            algorithm=algorithm,
+            adaptive_density=adaptive_density,
+            depth_weight=depth_weight,
+            count_saturation=count_saturation,
+            time_budget_ms=time_budget_ms,
+            extent_margin=extent_margin,
         )
 
     def make_slic_model(self, num_components):
         return SlicModelAvx2(num_components)
 
+    def iterate_volume(self, volume, max_iter=10):
+        """Supervoxels of volume (uint8 [D, H, W, 3]) in a single 3-D pass; returns the labels (int32 [D, H, W])."""
+        volume = as_image(volume)
+        if self._slic_model.cluster_z is None:
+            self._slic_model.initialize_volume(volume)
+        # Window corners are 3S away in a volume against 2S in an image
+        D, H, W = volume.shape[:3]
+        quantize_level = self.resolve_quantize_level(volume.reshape(D * H, W, 3), 1.5 * self.compactness)
+        return self._slic_model.iterate_volume(volume, max_iter, self.compactness, self.min_size_factor, quantize_level)
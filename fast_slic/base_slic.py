@@ -1,10 +1,39 @@
+import numpy as np
+from cfast_slic import auto_quantize_level, check_options
+
+
+def as_image(image):
+    """image as a C-contiguous array, without casting: other dtypes than uint8 raise TypeError."""
+    image = np.asarray(image)
+    if image.dtype != np.uint8:
+        raise TypeError("image must be uint8, got {}".format(image.dtype))
+    return np.ascontiguousarray(image)
+
+
 class BaseSlic(object):
-    def __init__(self, num_components, slic_model, compactness, min_size_factor, quantize_level):
+    def __init__(self, num_components, slic_model, compactness, min_size_factor, quantize_level, incremental=False, motion_search_radius=0, pyramid_levels=0, band_start_iter=0, bound_start_iter=0, subsample_iters=0, algorithm=None, adaptive_density=False, depth_weight=1.0, count_saturation=False, time_budget_ms=0, extent_margin=0):
+        check_options(incremental=incremental, adaptive=adaptive_density, pyramid_levels=pyramid_levels, band_start_iter=band_start_iter,
+                      bound_start_iter=bound_start_iter, subsample_iters=subsample_iters, algorithm=algorithm, extent_margin=extent_margin)
         self.compactness = compactness
         self.quantize_level = quantize_level
         self.min_size_factor = min_size_factor
+        self.incremental = incremental
+        self.motion_search_radius = motion_search_radius
+        self.pyramid_levels = pyramid_levels
+        self.band_start_iter = band_start_iter
+        self.bound_start_iter = bound_start_iter
+        self.subsample_iters = subsample_iters
+        self.algorithm = algorithm
+        self.adaptive_density = adaptive_density
+        self.depth_weight = depth_weight
+        self.count_saturation = count_saturation
+        self.time_budget_ms = time_budget_ms
+        self.extent_margin = extent_margin
         self._slic_model = slic_model and slic_model.copy() or self.make_slic_model(num_components or 100)
         self._last_assignment = None
+        self._last_image = None
+        # Incremental mode: the frame each tile's labels were last computed on, updated in place by iterate
+        self._reference_image = None
 
     @property
     def slic_model(self):
@@ -14,13 +43,68 @@ class BaseSlic(object):
     def last_assignment(self):
         return self._last_assignment
 
-    def iterate(self, image, max_iter=10):
+    def iterate(self, image, max_iter=10, density=None, depth=None):
+        """density (optional float [H, W]): detail map for the adaptive seeding, used when the model is initialized.
+        depth (optional uint16 or float [H, W]): depth map aligned with image, weighted by depth_weight (avx2 only).
+        """
+        image = as_image(image)
+        # The incremental mode only reaches the kernels from the second frame on: check it from the first one
+        adaptive = self.adaptive_density or density is not None or self._slic_model.cluster_S is not None
+        check_options(incremental=self.incremental, adaptive=adaptive, depth=depth is not None, pyramid_levels=self.pyramid_levels,
+                      band_start_iter=self.band_start_iter, bound_start_iter=self.bound_start_iter,
+                      subsample_iters=self.subsample_iters, algorithm=self.algorithm, extent_margin=self.extent_margin)
         if not self._slic_model.initialized:
-            self._slic_model.initialize(image)
-        assignment = self._slic_model.iterate(image, max_iter, self.compactness, self.min_size_factor, self.quantize_level)
+            if self.adaptive_density or density is not None:
+                # Seeds follow the local detail, each cluster with its own window size
+                self._slic_model.initialize_adaptive(image, density)
+            else:
+                self._slic_model.initialize(image)
+        options = {'pyramid_levels': self.pyramid_levels, 'band_start_iter': self.band_start_iter,
+                   'bound_start_iter': self.bound_start_iter, 'subsample_iters': self.subsample_iters, 'algorithm': self.algorithm,
+                   'depth': depth, 'depth_weight': self.depth_weight, 'count_saturation': self.count_saturation,
+                   'time_budget_ms': self.time_budget_ms, 'extent_margin': self.extent_margin}
+        quantize_level = self.resolve_quantize_level(image)
+        has_last_frame = self._last_image is not None and self._last_image.shape == image.shape
+        if self.motion_search_radius > 0 and has_last_frame:
+            # Seed the clusters where they moved to since the last frame
+            H, W = image.shape[:2]
+            motion = self._slic_model.estimate_motion(self._last_image, image, self._last_assignment, self.motion_search_radius)
+            self._slic_model.move_clusters(motion, H, W)
+        if self.incremental and self._reference_image is not None and self._reference_image.shape == image.shape:
+            # Re-run only where the frame drifted away from the one the labels were computed on
+            options['prev_image'] = self._reference_image
+            options['prev_assignment'] = self._last_assignment
+        elif self.incremental:
+            self._reference_image = np.array(image, dtype=np.uint8, order='C')
+        if self.motion_search_radius > 0:
+            self._last_image = np.array(image, dtype=np.uint8, order='C')
+        assignment = self._slic_model.iterate(image, max_iter, self.compactness, self.min_size_factor, quantize_level, options)
         self._last_assignment = assignment
         return assignment
 
+    def resolve_quantize_level(self, image, compactness=None):
+        """quantize_level for image: the configured one, or with quantize_level='auto' the finest one whose distances cannot saturate.
+
+        The depth channel of the RGB-D mode is not accounted for; count_saturation tells whether it saturates.
+        """
+        if self.quantize_level != 'auto':
+            return self.quantize_level
+        return auto_quantize_level(image, self.compactness if compactness is None else compactness)
+
+    @property
+    def num_saturated(self):
+        """Saturated candidate distances of the last iterate, when constructed with count_saturation=True.
+
+        None when the kernel that ran cannot count: the standard backend, other kernels than the cluster-oriented one,
+        and the pyramid, band and bounds modes.
+        """
+        return self._slic_model.num_saturated
+
+    @property
+    def num_iterations(self):
+        """Iterations run by the last iterate; fewer than max_iter when time_budget_ms cut them short."""
+        return self._slic_model.num_iterations
+
     @property
     def num_components(self):
         return self._slic_model.num_components
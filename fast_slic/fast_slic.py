@@ -3,13 +3,32 @@ from .base_slic import BaseSlic
 
 
 class Slic(BaseSlic):
-    def __init__(self, num_components=None, slic_model=None, compactness=10, min_size_factor=0.05, quantize_level=6):
+    def __init__(self, num_components=None, slic_model=None, compactness=10, min_size_factor=0.05, quantize_level=6, incremental=False, motion_search_radius=0, pyramid_levels=0, band_start_iter=0, bound_start_iter=0, subsample_iters=0, algorithm=None, adaptive_density=False, depth_weight=1.0, count_saturation=False, time_budget_ms=0, extent_margin=0):
+        # Options of the avx2 backend only; the standard one would ignore them
+        for name, value in (('incremental', incremental), ('pyramid_levels', pyramid_levels), ('band_start_iter', band_start_iter),
+                            ('bound_start_iter', bound_start_iter), ('subsample_iters', subsample_iters), ('extent_margin', extent_margin)):
+            if value:
+                raise ValueError("{} is only supported by SlicAvx2".format(name))
+        if algorithm not in (None, 'cluster_oriented', 'snic'):
+            raise ValueError("algorithm={!r} is only supported by SlicAvx2".format(algorithm))
         super().__init__(
             num_components=num_components,
             slic_model=slic_model,
             compactness=compactness,
             min_size_factor=min_size_factor,
             quantize_level=quantize_level,
+            incremental=incremental,
+            motion_search_radius=motion_search_radius,
+            pyramid_levels=pyramid_levels,
+            band_start_iter=band_start_iter,
+            bound_start_iter=bound_start_iter,
+            subsample_iters=subsample_iters,
+            algorithm=algorithm,
+            adaptive_density=adaptive_density,
+            depth_weight=depth_weight,
+            count_saturation=count_saturation,
+            time_budget_ms=time_budget_ms,
+            extent_margin=extent_margin,
         )
 
     def make_slic_model(self, num_components):
@@ -0,0 +1,304 @@
+#ifndef _PERMUTOHEDRAL_HPP
+#define _PERMUTOHEDRAL_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Permutohedral lattice for high-dimensional gaussian filtering.
+// (Adams, Baek, Davis. Fast High-Dimensional Filtering Using the Permutohedral Lattice. 2010)
+namespace permutohedral {
+    // Open-addressing hash table mapping the first D coordinates of a lattice key to a vertex index.
+    // Keys are 32-bit: a coordinate is about (D + 1) times the feature value, which overflows 16 bits
+    // for features in the thousands (a wide image over a small spatial bandwidth).
+    template <int D>
+    class HashTable {
+    private:
+        std::vector<int32_t> keys;
+        std::vector<int> table;
+        size_t mask;
+        int filled;
+    public:
+        HashTable(size_t expected_size = 0) : filled(0) {
+            size_t capacity = 64;
+            while (capacity < 2 * expected_size) capacity <<= 1;
+            table.assign(capacity, -1);
+            mask = capacity - 1;
+            keys.reserve(expected_size * D);
+        }
+
+        int size() const { return filled; }
+        const int32_t* get_key(int index) const { return &keys[(size_t)index * D]; }
+
+        int find(const int32_t* key, bool create) {
+            if (create && 2 * (size_t)filled >= table.size()) grow();
+            size_t slot = hash(key) & mask;
+            while (true) {
+                int entry = table[slot];
+                if (entry < 0) {
+                    if (!create) return -1;
+                    keys.insert(keys.end(), key, key + D);
+                    table[slot] = filled;
+                    return filled++;
+                }
+                if (!std::memcmp(&keys[(size_t)entry * D], key, sizeof(int32_t) * D)) return entry;
+                slot = (slot + 1) & mask;
+            }
+        }
+
+        int find(const int32_t* key) const {
+            size_t slot = hash(key) & mask;
+            while (true) {
+                int entry = table[slot];
+                if (entry < 0) return -1;
+                if (!std::memcmp(&keys[(size_t)entry * D], key, sizeof(int32_t) * D)) return entry;
+                slot = (slot + 1) & mask;
+            }
+        }
+    private:
+        static size_t hash(const int32_t* key) {
+            size_t h = 0;
+            for (int i = 0; i < D; i++) {
+                h = (h + (uint32_t)key[i]) * 2531011;
+            }
+            return h;
+        }
+
+        void grow() {
+            std::vector<int> new_table(table.size() * 2, -1);
+            size_t new_mask = new_table.size() - 1;
+            for (int entry = 0; entry < filled; entry++) {
+                size_t slot = hash(&keys[(size_t)entry * D]) & new_mask;
+                while (new_table[slot] >= 0) slot = (slot + 1) & new_mask;
+                new_table[slot] = entry;
+            }
+            table.swap(new_table);
+            mask = new_mask;
+        }
+    };
+
+    template <int D>
+    class Lattice {
+    private:
+        int N = 0;
+        int M = 0;
+        // [N, D + 1]: lattice vertex of each simplex corner, shifted by one so that 0 means "no vertex"
+        std::vector<int> offsets;
+        std::vector<float> barycentrics;
+        // Splat as a gather: the (point, corner) entries of each vertex, in CSR form over the vertices
+        std::vector<int> vertex_entry_offsets;
+        std::vector<int> vertex_entries;
+        // [D + 1, M, 2]: neighboring vertices along each lattice axis, shifted by one as well
+        std::vector<int> blur_neighbors;
+    public:
+        int num_vertices() const { return M; }
+
+        // features: float[] of shape [N, D], already divided by the standard deviation of each dimension
+        void init(const float* features, int N) {
+            this->N = N;
+            offsets.resize((size_t)N * (D + 1));
+            barycentrics.resize((size_t)N * (D + 1));
+
+            // Points are embedded chunk by chunk, each chunk with its own hash table, then the tables are merged.
+            // The chunks do not depend on the number of threads, so neither does the vertex numbering.
+            const int num_chunks = std::max(std::min(16, N / 2048), 1);
+            std::vector<HashTable<D>> chunk_tables(num_chunks);
+            #pragma omp parallel for schedule(dynamic)
+            for (int chunk = 0; chunk < num_chunks; chunk++) {
+                int n_lo = (int)((int64_t)N * chunk / num_chunks), n_hi = (int)((int64_t)N * (chunk + 1) / num_chunks);
+                chunk_tables[chunk] = HashTable<D>((size_t)(n_hi - n_lo));
+                embed(features, n_lo, n_hi, chunk_tables[chunk]);
+            }
+
+            HashTable<D> hash_table((size_t)chunk_tables[0].size() * num_chunks);
+            std::vector< std::vector<int> > chunk_vertices(num_chunks);
+            for (int chunk = 0; chunk < num_chunks; chunk++) {
+                const HashTable<D>& chunk_table = chunk_tables[chunk];
+                chunk_vertices[chunk].resize(chunk_table.size());
+                for (int entry = 0; entry < chunk_table.size(); entry++) {
+                    chunk_vertices[chunk][entry] = hash_table.find(chunk_table.get_key(entry), true);
+                }
+            }
+            #pragma omp parallel for schedule(dynamic)
+            for (int chunk = 0; chunk < num_chunks; chunk++) {
+                int n_lo = (int)((int64_t)N * chunk / num_chunks), n_hi = (int)((int64_t)N * (chunk + 1) / num_chunks);
+                const std::vector<int>& vertices = chunk_vertices[chunk];
+                for (size_t e = (size_t)n_lo * (D + 1); e < (size_t)n_hi * (D + 1); e++) {
+                    offsets[e] = vertices[offsets[e] - 1] + 1;
+                }
+            }
+            std::vector<HashTable<D>>().swap(chunk_tables);
+
+            M = hash_table.size();
+            vertex_entry_offsets.assign(M + 2, 0);
+            for (size_t e = 0; e < offsets.size(); e++) vertex_entry_offsets[offsets[e] + 1]++;
+            for (int o = 0; o <= M; o++) vertex_entry_offsets[o + 1] += vertex_entry_offsets[o];
+            vertex_entries.resize(offsets.size());
+            {
+                std::vector<int> fill(vertex_entry_offsets.begin(), vertex_entry_offsets.end() - 1);
+                for (size_t e = 0; e < offsets.size(); e++) vertex_entries[fill[offsets[e]]++] = (int)e;
+            }
+
+            // Stepping along an axis is a bijection of the lattice: u = n1(v) iff v = n2(u), so only n1 is looked up.
+            // Neighbors outside the lattice stay 0.
+            blur_neighbors.assign((size_t)(D + 1) * M * 2, 0);
+            const HashTable<D>& table = hash_table;
+            for (int j = 0; j <= D; j++) {
+                #pragma omp parallel for
+                for (int i = 0; i < M; i++) {
+                    const int32_t* vertex_key = table.get_key(i);
+                    int32_t n1[D];
+                    for (int k = 0; k < D; k++) {
+                        n1[k] = vertex_key[k] + 1;
+                    }
+                    if (j < D) {
+                        n1[j] = vertex_key[j] - D;
+                    }
+                    int neighbor = table.find(n1);
+                    if (neighbor >= 0) {
+                        blur_neighbors[((size_t)j * M + i) * 2] = neighbor + 1;
+                        blur_neighbors[((size_t)j * M + neighbor) * 2 + 1] = i + 1;
+                    }
+                }
+            }
+        }
+
+        // in, out: float[] of shape [N, value_size]
+        void compute(const float* in, float* out, int value_size) const {
+            const int vd = value_size;
+            std::vector<float> values((size_t)(M + 1) * vd, 0.0f);
+            std::vector<float> new_values((size_t)(M + 1) * vd, 0.0f);
+
+            // Splat
+            #pragma omp parallel for
+            for (int o = 1; o <= M; o++) {
+                float* value = &values[(size_t)o * vd];
+                for (int k = vertex_entry_offsets[o]; k < vertex_entry_offsets[o + 1]; k++) {
+                    int e = vertex_entries[k];
+                    float w = barycentrics[e];
+                    const float* in_val = in + (size_t)(e / (D + 1)) * vd;
+                    for (int c = 0; c < vd; c++) {
+                        value[c] += w * in_val[c];
+                    }
+                }
+            }
+
+            // Blur along each lattice axis with a [1 2 1] / 2 kernel
+            for (int j = 0; j <= D; j++) {
+                #pragma omp parallel for
+                for (int i = 0; i < M; i++) {
+                    int n1 = blur_neighbors[((size_t)j * M + i) * 2];
+                    int n2 = blur_neighbors[((size_t)j * M + i) * 2 + 1];
+                    const float* old_val = &values[(size_t)(i + 1) * vd];
+                    const float* n1_val = &values[(size_t)n1 * vd];
+                    const float* n2_val = &values[(size_t)n2 * vd];
+                    float* new_val = &new_values[(size_t)(i + 1) * vd];
+                    for (int k = 0; k < vd; k++) {
+                        new_val[k] = old_val[k] + 0.5f * (n1_val[k] + n2_val[k]);
+                    }
+                }
+                values.swap(new_values);
+            }
+
+            // Slice
+            const float alpha = 1.0f / (1.0f + powf(2.0f, -(float)D));
+            #pragma omp parallel for
+            for (int n = 0; n < N; n++) {
+                float* out_val = out + (size_t)n * vd;
+                for (int k = 0; k < vd; k++) out_val[k] = 0;
+                for (int r = 0; r <= D; r++) {
+                    int o = offsets[(size_t)n * (D + 1) + r];
+                    float w = barycentrics[(size_t)n * (D + 1) + r];
+                    for (int k = 0; k < vd; k++) {
+                        out_val[k] += w * values[(size_t)o * vd + k] * alpha;
+                    }
+                }
+            }
+        }
+    private:
+        // Finds the enclosing simplex of points [n_lo, n_hi). offsets receive indices into hash_table, shifted by one.
+        void embed(const float* features, int n_lo, int n_hi, HashTable<D>& hash_table) {
+            float scale_factor[D];
+            const float inv_std_dev = sqrtf(2.0f / 3.0f) * (D + 1);
+            for (int i = 0; i < D; i++) {
+                scale_factor[i] = inv_std_dev / sqrtf((float)(i + 1) * (i + 2));
+            }
+
+            float elevated[D + 1], barycentric[D + 2];
+            int rem0[D + 1], rank[D + 1];
+            int32_t key[D];
+            // Neighboring points mostly fall into the same simplex; remember the last vertex of each corner
+            int32_t last_keys[D + 1][D];
+            int last_vertices[D + 1];
+            for (int r = 0; r <= D; r++) last_vertices[r] = -1;
+            const float down_factor = 1.0f / (D + 1);
+
+            for (int n = n_lo; n < n_hi; n++) {
+                const float* f = features + (size_t)n * D;
+
+                // Elevate the feature onto the hyperplane (y = Ep)
+                float sm = 0;
+                for (int j = D; j > 0; j--) {
+                    float cf = f[j - 1] * scale_factor[j - 1];
+                    elevated[j] = sm - j * cf;
+                    sm += cf;
+                }
+                elevated[0] = sm;
+
+                // Find the closest zero-colored lattice point
+                int sum = 0;
+                for (int i = 0; i <= D; i++) {
+                    int rd = (int)floorf(down_factor * elevated[i] + 0.5f);
+                    rem0[i] = rd * (D + 1);
+                    sum += rd;
+                }
+
+                // Rank the differential to find the enclosing simplex
+                for (int i = 0; i <= D; i++) rank[i] = 0;
+                for (int i = 0; i < D; i++) {
+                    float di = elevated[i] - rem0[i];
+                    for (int j = i + 1; j <= D; j++) {
+                        if (di < elevated[j] - rem0[j]) rank[i]++;
+                        else rank[j]++;
+                    }
+                }
+
+                // Bring the point back onto the plane if the rounding went off
+                for (int i = 0; i <= D; i++) {
+                    rank[i] += sum;
+                    if (rank[i] < 0) {
+                        rank[i] += D + 1;
+                        rem0[i] += D + 1;
+                    } else if (rank[i] > D) {
+                        rank[i] -= D + 1;
+                        rem0[i] -= D + 1;
+                    }
+                }
+
+                for (int i = 0; i <= D + 1; i++) barycentric[i] = 0;
+                for (int i = 0; i <= D; i++) {
+                    float v = (elevated[i] - rem0[i]) * down_factor;
+                    barycentric[D - rank[i]] += v;
+                    barycentric[D - rank[i] + 1] -= v;
+                }
+                barycentric[0] += 1.0f + barycentric[D + 1];
+
+                for (int remainder = 0; remainder <= D; remainder++) {
+                    for (int i = 0; i < D; i++) {
+                        key[i] = rem0[i] + ((rank[i] <= D - remainder) ? remainder : remainder - (D + 1));
+                    }
+                    if (last_vertices[remainder] < 0 || std::memcmp(last_keys[remainder], key, sizeof(key))) {
+                        std::memcpy(last_keys[remainder], key, sizeof(key));
+                        last_vertices[remainder] = hash_table.find(key, true);
+                    }
+                    offsets[(size_t)n * (D + 1) + remainder] = last_vertices[remainder] + 1;
+                    barycentrics[(size_t)n * (D + 1) + remainder] = barycentric[remainder];
+                }
+            }
+        }
+    };
+}
+
+#endif
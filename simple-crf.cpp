@@ -1,8 +1,11 @@
 #include <cmath>
+#include <cstdlib>
+#include <cstdint>
 #include <algorithm>
 #include <map>
 #include <utility>
 #include "simple-crf.hpp"
+#include "permutohedral.hpp"
 
 void SimpleCRFFrame::set_clusters(const Cluster* clusters) {
     std::copy(clusters, clusters + num_nodes, this->clusters.begin());
@@ -18,6 +21,133 @@ void SimpleCRFFrame::set_connectivity(const Connectivity* conn) {
     }
 }
 
+// Clusters that touch in the assignment (4-connectivity), as CSR arrays
+static void slic_adjacency(int H, int W, int K, const uint32_t* assignment, std::vector<int>& offsets, std::vector<int>& indices) {
+    std::vector<uint64_t> pairs;
+    auto add_pair = [&](uint32_t a, uint32_t b) {
+        if (a == b || a >= (uint32_t)K || b >= (uint32_t)K) return;
+        uint64_t pair = (a < b) ? ((uint64_t)a << 32 | b) : ((uint64_t)b << 32 | a);
+        // Borders run along rows and columns, so most repeats are back to back
+        if (pairs.empty() || pairs.back() != pair) pairs.push_back(pair);
+    };
+    for (int i = 0; i < H; i++) {
+        const uint32_t* row = assignment + (size_t)W * i;
+        for (int j = 0; j + 1 < W; j++) add_pair(row[j], row[j + 1]);
+        if (i + 1 < H) {
+            for (int j = 0; j < W; j++) add_pair(row[j], row[j + W]);
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    offsets.assign(K + 1, 0);
+    for (uint64_t pair : pairs) {
+        offsets[(pair >> 32) + 1]++;
+        offsets[(pair & 0xFFFFFFFF) + 1]++;
+    }
+    for (int k = 0; k < K; k++) offsets[k + 1] += offsets[k];
+    indices.resize(offsets[K]);
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (uint64_t pair : pairs) {
+        int a = (int)(pair >> 32), b = (int)(pair & 0xFFFFFFFF);
+        indices[fill[a]++] = b;
+        indices[fill[b]++] = a;
+    }
+}
+
+// The knn nearest cluster centers (L1 distance) of each cluster, as CSR arrays.
+// Centers are bucketed into cells of the grid spacing S; the search covers 3 cells around a center.
+static void slic_knn_adjacency(int H, int W, int K, const Cluster* clusters, size_t knn, std::vector<int>& offsets, std::vector<int>& indices) {
+    const int S = std::max((int)sqrtf((float)H * W / std::max(K, 1)), 1);
+    const int nh = (H + S - 1) / S, nw = (W + S - 1) / S;
+    std::vector<int> cell_offsets(nh * nw + 1, 0), cell_clusters(K);
+    auto cell_of = [&](const Cluster& cluster) {
+        return std::min(cluster.y / S, nh - 1) * nw + std::min(cluster.x / S, nw - 1);
+    };
+    for (int k = 0; k < K; k++) cell_offsets[cell_of(clusters[k]) + 1]++;
+    for (int c = 0; c < nh * nw; c++) cell_offsets[c + 1] += cell_offsets[c];
+    std::vector<int> fill(cell_offsets.begin(), cell_offsets.end() - 1);
+    for (int k = 0; k < K; k++) cell_clusters[fill[cell_of(clusters[k])]++] = k;
+
+    offsets.resize(K + 1);
+    indices.resize((size_t)K * knn);
+    std::vector<int> num_found(K);
+    #pragma omp parallel for
+    for (int k = 0; k < K; k++) {
+        const Cluster& cluster = clusters[k];
+        const int cy = std::min(cluster.y / S, nh - 1), cx = std::min(cluster.x / S, nw - 1);
+        // Max-heap of (distance, cluster) keeps the knn closest
+        std::vector<std::pair<int, int>> heap;
+        for (int y = std::max(cy - 3, 0); y <= std::min(cy + 3, nh - 1); y++) {
+            for (int x = std::max(cx - 3, 0); x <= std::min(cx + 3, nw - 1); x++) {
+                for (int c = cell_offsets[y * nw + x]; c < cell_offsets[y * nw + x + 1]; c++) {
+                    int other = cell_clusters[c];
+                    if (other == k) continue;
+                    int distance = std::abs(clusters[other].x - cluster.x) + std::abs(clusters[other].y - cluster.y);
+                    if (heap.size() >= knn && heap.front().first <= distance) continue;
+                    heap.emplace_back(distance, other);
+                    std::push_heap(heap.begin(), heap.end());
+                    if (heap.size() > knn) {
+                        std::pop_heap(heap.begin(), heap.end());
+                        heap.pop_back();
+                    }
+                }
+            }
+        }
+        std::sort_heap(heap.begin(), heap.end());
+        num_found[k] = (int)heap.size();
+        for (size_t n = 0; n < heap.size(); n++) indices[(size_t)k * knn + n] = heap[n].second;
+    }
+    // Compact the fixed-size slots
+    offsets[0] = 0;
+    for (int k = 0; k < K; k++) {
+        offsets[k + 1] = offsets[k] + num_found[k];
+        std::copy_n(&indices[(size_t)k * knn], num_found[k], &indices[offsets[k]]);
+    }
+    indices.resize(offsets[K]);
+}
+
+void SimpleCRFFrame::set_slic(int H, int W, const Cluster* clusters, const uint32_t* assignment, size_t knn, const float* probas, const float* unaries) {
+    set_clusters(clusters);
+    std::vector<int> offsets, indices;
+    if (knn > 0) {
+        slic_knn_adjacency(H, W, (int)num_nodes, clusters, knn, offsets, indices);
+    } else {
+        slic_adjacency(H, W, (int)num_nodes, assignment, offsets, indices);
+    }
+    for (size_t i = 0; i < num_nodes; i++) {
+        edges[i].assign(indices.begin() + offsets[i], indices.begin() + offsets[i + 1]);
+    }
+
+    if (probas != nullptr) {
+        pool_probas(H, W, assignment, probas);
+    } else if (unaries != nullptr) {
+        set_unary(unaries);
+    } else {
+        set_unbiased();
+    }
+}
+
+void SimpleCRFFrame::pool_probas(int H, int W, const uint32_t* assignment, const float* probas) {
+    const size_t N = (size_t)H * W;
+    std::vector<int> counts(num_nodes, 0);
+    for (size_t p = 0; p < N; p++) {
+        if (assignment[p] < num_nodes) counts[assignment[p]]++;
+    }
+    const float uniform_unary = logf((float)num_classes);
+    #pragma omp parallel for
+    for (int cls = 0; cls < (int)num_classes; cls++) {
+        const float* class_probas = probas + N * cls;
+        std::vector<float> sums(num_nodes, 0.0f);
+        for (size_t p = 0; p < N; p++) {
+            if (assignment[p] < num_nodes) sums[assignment[p]] += class_probas[p];
+        }
+        for (size_t i = 0; i < num_nodes; i++) {
+            unaries[num_nodes * cls + i] = (counts[i] > 0) ? -logf(std::max(sums[i] / counts[i], 1e-5f)) : uniform_unary;
+        }
+    }
+}
+
 void SimpleCRFFrame::normalize() {
     for (size_t i = 0; i < num_nodes; i++) {
         float sum = 0;
@@ -58,6 +188,258 @@ void SimpleCRFFrame::reset_inferred() {
     std::transform(unaries.begin(), unaries.end(), q.begin(), [](float unary) -> float { return expf(-unary); });
 }
 
+// exp(x) for x <= 0, to about 1e-5 relative error
+static inline float fast_exp(float x) {
+    float t = std::max(x, -80.0f) * 1.44269504f;
+    int i = (int)t;
+    if (t < i) i--;
+    float f = t - i;
+    // 2^f on [0, 1)
+    float p = 1.0f + f * (0.69314718f + f * (0.24022650f + f * (0.05550411f + f * (0.00961813f + f * 0.00133336f))));
+    union { float f; int32_t i; } bits;
+    bits.f = p;
+    bits.i += i * (1 << 23);
+    return bits.f;
+}
+
+void SimpleCRFFrame::refine_pixels(int H, int W, const uint8_t* image, const uint32_t* assignment, size_t max_iter, float* probas) const {
+    const int C = (int)num_classes;
+    if (H <= 0 || W <= 0 || C <= 0) return;
+    const size_t N = (size_t)H * W;
+
+    const float sxy = parent.params.refine_sxy, srgb = parent.params.refine_srgb;
+    const float weight = parent.params.refine_w;
+    const std::vector<float>& compat_by_class = parent.compat_by_class;
+
+    // Node-major superpixel marginals and unaries [num_nodes + 1, C]; the last row stands for unassigned pixels
+    std::vector<float> node_q((num_nodes + 1) * C), node_unaries((num_nodes + 1) * C);
+    for (size_t i = 0; i <= num_nodes; i++) {
+        for (int cls = 0; cls < C; cls++) {
+            float node_proba = (i < num_nodes) ? std::max(q[num_nodes * cls + i], 1e-5f) : 1.0f / C;
+            node_q[C * i + cls] = node_proba;
+            node_unaries[C * i + cls] = -logf(node_proba);
+        }
+    }
+    auto node_of = [this](uint32_t label) -> size_t { return (label < num_nodes) ? label : num_nodes; };
+
+    // All but the last mean-field step run on a grid of stride x stride pixel cells. The spatial kernel spans
+    // refine_sxy pixels, so a stride of refine_sxy / 5 hardly changes it while the lattice gets stride^2 fewer points.
+    const int stride = std::min(std::max((int)(sxy / 5), 1), 16);
+    const int gh = (H + stride - 1) / stride, gw = (W + stride - 1) / stride, M = gh * gw;
+    // Cells average the colors and the unpooled marginals of their pixels, every other row and column in large cells
+    const int step = (stride >= 4) ? 2 : 1;
+    std::vector<float> features((size_t)M * 5), cell_q((size_t)M * C), cell_unaries((size_t)M * C);
+    std::vector<uint8_t> cell_colors((size_t)M * 3);
+    #pragma omp parallel for
+    for (int gi = 0; gi < gh; gi++) {
+        std::vector<float> sums((size_t)gw * (3 + C));
+        std::vector<int> counts(gw);
+        const int i_lo = gi * stride, i_hi = std::min(H, i_lo + stride);
+        for (int i = i_lo; i < i_hi; i += step) {
+            for (int gj = 0; gj < gw; gj++) {
+                float* sum = &sums[(size_t)gj * (3 + C)];
+                const int j_hi = std::min(W, gj * stride + stride);
+                for (int j = gj * stride; j < j_hi; j += step) {
+                    size_t index = (size_t)W * i + j;
+                    sum[0] += image[3 * index];
+                    sum[1] += image[3 * index + 1];
+                    sum[2] += image[3 * index + 2];
+                    const float* pq = &node_q[C * node_of(assignment[index])];
+                    for (int cls = 0; cls < C; cls++) sum[3 + cls] += pq[cls];
+                    counts[gj]++;
+                }
+            }
+        }
+        for (int gj = 0; gj < gw; gj++) {
+            const int j_lo = gj * stride, j_hi = std::min(W, j_lo + stride);
+            const float inv_count = 1.0f / counts[gj];
+            const float* sum = &sums[(size_t)gj * (3 + C)];
+            size_t cell = (size_t)gw * gi + gj;
+            float* f = &features[5 * cell];
+            f[0] = 0.5f * (j_lo + j_hi - 1) / sxy;
+            f[1] = 0.5f * (i_lo + i_hi - 1) / sxy;
+            for (int k = 0; k < 3; k++) {
+                f[2 + k] = sum[k] * inv_count / srgb;
+                cell_colors[3 * cell + k] = (uint8_t)(sum[k] * inv_count + 0.5f);
+            }
+            for (int cls = 0; cls < C; cls++) {
+                float cell_proba = sum[3 + cls] * inv_count;
+                cell_q[C * cell + cls] = cell_proba;
+                cell_unaries[C * cell + cls] = -logf(std::max(cell_proba, 1e-5f));
+            }
+        }
+    }
+
+    permutohedral::Lattice<5> lattice;
+    lattice.init(features.data(), M);
+    std::vector<float>().swap(features);
+
+    std::vector<float> norms(M, 1.0f), messages((size_t)M * C), cell_energies((size_t)M * C, 0.0f);
+    lattice.compute(std::vector<float>(norms).data(), norms.data(), 1);
+    for (auto& norm : norms) {
+        norm = 1.0f / (norm + 1e-20f);
+    }
+
+    // Potts model: the energy of a class gathers the normalized messages of the other classes
+    auto pass_messages = [&]() {
+        lattice.compute(cell_q.data(), messages.data(), C);
+        #pragma omp parallel for
+        for (int cell = 0; cell < M; cell++) {
+            const float* message = &messages[(size_t)C * cell];
+            float total = 0;
+            for (int cls = 0; cls < C; cls++) total += compat_by_class[cls] * message[cls];
+            for (int cls = 0; cls < C; cls++) {
+                cell_energies[(size_t)C * cell + cls] = weight * norms[cell] * (total - compat_by_class[cls] * message[cls]);
+            }
+        }
+    };
+    // out[out_stride * cls] = softmax(-energy); energy is overwritten
+    auto normalize = [C](float* energy, float* out, size_t out_stride) {
+        float min_energy = energy[0];
+        for (int cls = 1; cls < C; cls++) min_energy = std::min(min_energy, energy[cls]);
+        float sum = 0;
+        for (int cls = 0; cls < C; cls++) {
+            energy[cls] = fast_exp(min_energy - energy[cls]);
+            sum += energy[cls];
+        }
+        const float inv_sum = 1.0f / sum;
+        for (int cls = 0; cls < C; cls++) out[out_stride * cls] = energy[cls] * inv_sum;
+    };
+
+    for (size_t iter = 1; iter < max_iter; iter++) {
+        pass_messages();
+        #pragma omp parallel
+        {
+            std::vector<float> energy(C);
+            #pragma omp for
+            for (int cell = 0; cell < M; cell++) {
+                for (int cls = 0; cls < C; cls++) {
+                    energy[cls] = cell_unaries[(size_t)C * cell + cls] + cell_energies[(size_t)C * cell + cls];
+                }
+                normalize(energy.data(), &cell_q[(size_t)C * cell], 1);
+            }
+        }
+    }
+    if (max_iter > 0) pass_messages();
+
+    // Last step at full resolution: each pixel keeps its own unary and takes the energies of the 2x2 cells around it,
+    // weighted bilinearly and by color similarity (a joint bilateral upsampling), so labels follow the pixel edges.
+    // The weights only matter where they can move the result by more than about 1%: where the four energies of a class
+    // spread over more than `tolerance`, unless one class wins by more than log(1 / tolerance) whatever the weights.
+    // Elsewhere the pixel takes the energies of its top-left cell, and a run of such pixels with one superpixel and
+    // one top-left cell shares the result.
+    const float tolerance = 0.01f, winning_margin = logf(1.0f / tolerance);
+    // Range of the energies of each class over the 2x2 cells from each cell on
+    std::vector<float> block_min((size_t)M * C), block_max((size_t)M * C);
+    #pragma omp parallel for
+    for (int gi = 0; gi < gh; gi++) {
+        const int gi_hi = std::min(gi + 1, gh - 1);
+        for (int gj = 0; gj < gw; gj++) {
+            const int gj_hi = std::min(gj + 1, gw - 1);
+            const float* e[4] = {
+                &cell_energies[(size_t)C * (gw * gi + gj)], &cell_energies[(size_t)C * (gw * gi + gj_hi)],
+                &cell_energies[(size_t)C * (gw * gi_hi + gj)], &cell_energies[(size_t)C * (gw * gi_hi + gj_hi)],
+            };
+            for (int cls = 0; cls < C; cls++) {
+                const size_t k = (size_t)C * (gw * gi + gj) + cls;
+                block_min[k] = std::min(std::min(e[0][cls], e[1][cls]), std::min(e[2][cls], e[3][cls]));
+                block_max[k] = std::max(std::max(e[0][cls], e[1][cls]), std::max(e[2][cls], e[3][cls]));
+            }
+        }
+    }
+    // Whether the weights can be ignored for a superpixel unary and a block
+    auto is_shared = [&](const float* unary, size_t block) {
+        const float* lo = &block_min[C * block];
+        const float* hi = &block_max[C * block];
+        bool flat = true;
+        int best = 0;
+        for (int cls = 0; cls < C; cls++) {
+            flat = flat && hi[cls] - lo[cls] < tolerance;
+            if (unary[cls] + hi[cls] < unary[best] + hi[best]) best = cls;
+        }
+        if (flat) return true;
+        for (int cls = 0; cls < C; cls++) {
+            if (cls != best && unary[cls] + lo[cls] < unary[best] + hi[best] + winning_margin) return false;
+        }
+        return true;
+    };
+    float color_weights[256];
+    for (int k = 0; k < 256; k++) {
+        color_weights[k] = expf(-0.5f * (k * k) / (srgb * srgb)) + 1e-4f;
+    }
+    std::vector<int> col_lo(W), col_hi(W);
+    std::vector<float> col_frac(W);
+    for (int j = 0; j < W; j++) {
+        float fx = std::min(std::max((j - 0.5f * (stride - 1)) / stride, 0.0f), (float)(gw - 1));
+        col_lo[j] = (int)fx;
+        col_hi[j] = std::min(col_lo[j] + 1, gw - 1);
+        col_frac[j] = fx - col_lo[j];
+    }
+    #pragma omp parallel for
+    for (int i = 0; i < H; i++) {
+        float fy = std::min(std::max((i - 0.5f * (stride - 1)) / stride, 0.0f), (float)(gh - 1));
+        const int row_lo = (int)fy, row_hi = std::min(row_lo + 1, gh - 1);
+        const float wy = fy - row_lo;
+        const uint8_t* colors_lo = &cell_colors[(size_t)3 * gw * row_lo];
+        const uint8_t* colors_hi = &cell_colors[(size_t)3 * gw * row_hi];
+        const float* energies_lo = &cell_energies[(size_t)C * gw * row_lo];
+        const float* energies_hi = &cell_energies[(size_t)C * gw * row_hi];
+        const uint32_t* row_assignment = &assignment[(size_t)W * i];
+        std::vector<float> energy(C), run_q(C);
+        // Last (superpixel, top-left cell) pair, and whether its pixels share one result
+        size_t last_node = SIZE_MAX;
+        int last_cell = -1;
+        bool shared = false;
+        for (int j = 0; j < W; j++) {
+            const size_t index = (size_t)W * i + j;
+            const size_t node = node_of(row_assignment[j]);
+            const int lo = col_lo[j], hi = col_hi[j];
+            if (node != last_node || lo != last_cell) {
+                last_node = node;
+                last_cell = lo;
+                shared = is_shared(&node_unaries[C * node], (size_t)gw * row_lo + lo);
+            }
+            if (shared) {
+                const float* unary = &node_unaries[C * node];
+                const float* e = &energies_lo[C * lo];
+                for (int cls = 0; cls < C; cls++) energy[cls] = unary[cls] + e[cls];
+                normalize(energy.data(), run_q.data(), 1);
+                int run_end = j + 1;
+                while (run_end < W && row_assignment[run_end] == row_assignment[j] && col_lo[run_end] == lo) run_end++;
+                for (int cls = 0; cls < C; cls++) {
+                    std::fill(probas + N * cls + index, probas + N * cls + index + (run_end - j), run_q[cls]);
+                }
+                j = run_end - 1;
+                continue;
+            }
+
+            const uint8_t* color = &image[3 * index];
+            const float wx = col_frac[j];
+            auto color_weight = [&](const uint8_t* cell_color) {
+                return color_weights[std::abs(color[0] - cell_color[0])] *
+                    color_weights[std::abs(color[1] - cell_color[1])] *
+                    color_weights[std::abs(color[2] - cell_color[2])];
+            };
+            float w00 = (1 - wy) * (1 - wx) * color_weight(&colors_lo[3 * lo]);
+            float w01 = (1 - wy) * wx * color_weight(&colors_lo[3 * hi]);
+            float w10 = wy * (1 - wx) * color_weight(&colors_hi[3 * lo]);
+            float w11 = wy * wx * color_weight(&colors_hi[3 * hi]);
+            const float inv_weight_sum = 1.0f / (w00 + w01 + w10 + w11 + 1e-20f);
+            w00 *= inv_weight_sum;
+            w01 *= inv_weight_sum;
+            w10 *= inv_weight_sum;
+            w11 *= inv_weight_sum;
+
+            const float* unary = &node_unaries[C * node];
+            const float *e00 = &energies_lo[C * lo], *e01 = &energies_lo[C * hi], *e10 = &energies_hi[C * lo], *e11 = &energies_hi[C * hi];
+            for (int cls = 0; cls < C; cls++) {
+                energy[cls] = unary[cls] + w00 * e00[cls] + w01 * e01[cls] + w10 * e10[cls] + w11 * e11[cls];
+            }
+            normalize(energy.data(), probas + index, N);
+        }
+    }
+}
+
 
 void SimpleCRF::infer_once() {
     simple_crf_time_t first_time = get_first_time(), last_time = get_last_time();
@@ -68,6 +450,23 @@ void SimpleCRF::infer_once() {
         float *compat_exps = new float[space_size()];
         const SimpleCRFFrame& frame = get_frame(t);
 
+        // Nodes of the next frame matched to each node, in CSR form
+        std::vector<int> next_offsets(num_nodes + 1, 0), next_nodes;
+        if (t < last_time) {
+            const SimpleCRFFrame& next_frame = get_frame(t + 1);
+            for (size_t j = 0; j < num_nodes; j++) {
+                int i = next_frame.prev_node(j);
+                if (i >= 0 && (size_t)i < num_nodes) next_offsets[i + 1]++;
+            }
+            for (size_t i = 0; i < num_nodes; i++) next_offsets[i + 1] += next_offsets[i];
+            next_nodes.resize(next_offsets[num_nodes]);
+            std::vector<int> fill(next_offsets.begin(), next_offsets.end() - 1);
+            for (size_t j = 0; j < num_nodes; j++) {
+                int i = next_frame.prev_node(j);
+                if (i >= 0 && (size_t)i < num_nodes) next_nodes[fill[i]++] = j;
+            }
+        }
+
         // Message passing
         for (size_t cls = 0; cls < num_classes; cls++) {
             for (size_t i = 0; i < num_nodes; i++) {
@@ -89,13 +488,18 @@ void SimpleCRF::infer_once() {
 
                 if (t > first_time) {
                     const SimpleCRFFrame& prev_frame = get_frame(t - 1);
-                    message += frame.calc_temporal_pairwise_energy(i, prev_frame) * prev_frame.q[num_nodes * cls + i] * sqrtf((float)prev_frame.clusters[i].num_members / num_members);
+                    int prev_i = frame.prev_node(i);
+                    if (prev_i >= 0 && (size_t)prev_i < num_nodes) {
+                        message += frame.calc_temporal_pairwise_energy(i, prev_frame, prev_i) * prev_frame.q[num_nodes * cls + prev_i] * sqrtf((float)prev_frame.clusters[prev_i].num_members / num_members);
+                    }
                 }
 
                 if (t < last_time) {
                     const SimpleCRFFrame& next_frame = get_frame(t + 1);
-                    message += frame.calc_temporal_pairwise_energy(i, next_frame) * next_frame.q[num_nodes * cls + i] * sqrtf((float)next_frame.clusters[i].num_members / num_members);
-;
+                    for (int k = next_offsets[i]; k < next_offsets[i + 1]; k++) {
+                        int next_i = next_nodes[k];
+                        message += frame.calc_temporal_pairwise_energy(i, next_frame, next_i) * next_frame.q[num_nodes * cls + next_i] * sqrtf((float)next_frame.clusters[next_i].num_members / num_members);
+                    }
                 }
                 messages[cls * num_nodes + i] = message;
             }
@@ -181,6 +585,9 @@ extern "C" {
     size_t simple_crf_num_time_frames(simple_crf_t crf) { return crf->get_num_frames(); }
     simple_crf_time_t simple_crf_pop_time_frame(simple_crf_t crf) { return crf->pop_frame(); }
     simple_crf_frame_t simple_crf_push_time_frame(simple_crf_t crf) { return &crf->push_frame(); };
+    simple_crf_frame_t simple_crf_push_slic_frame(simple_crf_t crf, int H, int W, int K, const Cluster* clusters, const uint32_t* assignment, size_t knn, const float* probas, const float* unaries) {
+        return &crf->push_slic_frame(H, W, K, clusters, assignment, knn, probas, unaries);
+    }
     simple_crf_frame_t simple_crf_time_frame(simple_crf_t crf, simple_crf_time_t time) {
         return &crf->get_frame(time);
     }
@@ -195,6 +602,10 @@ extern "C" {
         frame->set_connectivity(conn);
     }
 
+    void simple_crf_frame_set_temporal_correspondence(simple_crf_frame_t frame, const int* prev_nodes) {
+        frame->set_temporal_correspondence(prev_nodes);
+    }
+
     /*
      * Unary Getter/Setter
      */ 
@@ -270,6 +681,13 @@ extern "C" {
         frame->reset_inferred();
     }
 
+    /*
+     * Pixel-level refinement
+     */
+    void simple_crf_frame_refine_pixels(simple_crf_frame_t frame, int H, int W, const uint8_t* image, const uint32_t* assignment, size_t max_iter, float* probas) {
+        frame->refine_pixels(H, W, image, assignment, max_iter, probas);
+    }
+
     /*
      * Inference
      */
@@ -286,3 +704,69 @@ extern "C" {
         return new SimpleCRF(*crf);
     }
 };
+
+#ifdef PROTOTYPE_MAIN_DEMO
+#include <string>
+#include <chrono>
+#include <vector>
+#include <iostream>
+typedef std::chrono::high_resolution_clock Clock;
+// Times the pixel-level refinement of one frame: a gradient image with noise, square superpixels,
+// and a superpixel probability that follows the color of each square.
+int main(int argc, char** argv) {
+    int H = 720;
+    int W = 1280;
+    int block = 32;
+    int max_iter = 5;
+    try {
+        if (argc > 2) {
+            H = std::stoi(std::string(argv[1]));
+            W = std::stoi(std::string(argv[2]));
+        }
+        if (argc > 3) {
+            block = std::stoi(std::string(argv[3]));
+        }
+        if (argc > 4) {
+            max_iter = std::stoi(std::string(argv[4]));
+        }
+    } catch (...) {
+        std::cerr << "simple-crf [height width [superpixel_size [max_iter]]]" << std::endl;
+        return 2;
+    }
+
+    const int n_y = (H + block - 1) / block, n_x = (W + block - 1) / block, K = n_y * n_x;
+    std::vector<uint8_t> image((size_t)H * W * 3);
+    std::vector<uint32_t> assignment((size_t)H * W);
+    for (int i = 0; i < H; i++) {
+        for (int j = 0; j < W; j++) {
+            for (int c = 0; c < 3; c++) {
+                image[3 * ((size_t)W * i + j) + c] = (uint8_t)((c == 0 ? 255 * j / W : 255 * i / H) + rand() % 16 - 8);
+            }
+            assignment[(size_t)W * i + j] = (i / block) * n_x + j / block;
+        }
+    }
+    std::vector<float> proba(2 * K);
+    for (int k = 0; k < K; k++) {
+        proba[k] = ((k % n_x) * 2 < n_x) ? 0.8f : 0.2f;
+        proba[K + k] = 1 - proba[k];
+    }
+
+    SimpleCRF crf(2, K);
+    SimpleCRFFrame& frame = crf.push_frame();
+    frame.set_proba(proba.data());
+    crf.initialize();
+    std::vector<float> probas((size_t)2 * H * W);
+
+    long best = -1;
+    for (int r = 0; r < 5; r++) {
+        auto t1 = Clock::now();
+        frame.refine_pixels(H, W, image.data(), assignment.data(), max_iter, probas.data());
+        auto t2 = Clock::now();
+        long us = std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count();
+        if (best < 0 || us < best) best = us;
+    }
+    // About 14ms at 720p on a single core
+    std::cerr << best << "us \n";
+    return 0;
+}
+#endif
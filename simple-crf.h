@@ -16,6 +16,10 @@ typedef struct SimpleCRFParams {
     float spatial_sxy;
     float spatial_smooth_w;
     float spatial_smooth_sxy;
+    // Pixel-level refinement (bilateral kernel over x, y, r, g, b)
+    float refine_w;
+    float refine_sxy;
+    float refine_srgb;
 } SimpleCRFParams;
 
 
@@ -40,6 +44,12 @@ simple_crf_time_t simple_crf_last_time(simple_crf_t crf);
 size_t simple_crf_num_time_frames(simple_crf_t crf);
 simple_crf_time_t simple_crf_pop_time_frame(simple_crf_t crf);
 simple_crf_frame_t simple_crf_push_time_frame(simple_crf_t crf);
+// Pushes a frame built directly from SLIC output without intermediate copies.
+// clusters: Cluster[] of shape [K] (K must equal num_nodes), assignment: uint32_t[] of shape [H, W] (cluster numbers).
+// The edges join the clusters that touch in assignment, or each cluster to its knn nearest cluster centers if knn > 0.
+// probas: float[] of shape [num_classes, H, W], pixel probabilities averaged per cluster (nullable),
+// unaries: float[] of shape [num_classes, num_nodes], used if probas is NULL (nullable, unbiased if both are NULL)
+simple_crf_frame_t simple_crf_push_slic_frame(simple_crf_t crf, int H, int W, int K, const Cluster* clusters, const uint32_t* assignment, size_t knn, const float* probas, const float* unaries);
 simple_crf_frame_t simple_crf_time_frame(simple_crf_t crf, simple_crf_time_t time);
 simple_crf_time_t simple_crf_frame_get_time(simple_crf_frame_t frame);
 
@@ -50,6 +60,9 @@ simple_crf_time_t simple_crf_frame_get_time(simple_crf_frame_t frame);
 // const Cluster[] : shape [num_nodes]
 void simple_crf_frame_set_clusters(simple_crf_frame_t frame, const Cluster* clusters);
 void simple_crf_frame_set_connectivity(simple_crf_frame_t frame, const Connectivity* conn);
+// prev_nodes: int[] of shape [num_nodes], node of the previous frame matched to each node (-1: none).
+// NULL restores the default identity correspondence.
+void simple_crf_frame_set_temporal_correspondence(simple_crf_frame_t frame, const int* prev_nodes);
 
 /*
  * Unary Getter/Setter
@@ -84,6 +97,16 @@ float simple_crf_frame_temporal_pairwise_energy(simple_crf_frame_t frame, simple
 void simple_crf_frame_get_inferred(simple_crf_frame_t frame, float* log_probas);
 void simple_crf_frame_reset_inferred(simple_crf_frame_t frame);
 
+/*
+ * Pixel-level refinement
+ */
+
+// Unpools the inferred superpixel marginals to pixels and runs mean-field steps of a dense CRF
+// with a bilateral kernel evaluated on a permutohedral lattice.
+// image: uint8_t[] of shape [H, W, 3], assignment: uint32_t[] of shape [H, W] (cluster numbers),
+// probas: float[] of shape [num_classes, H, W]
+void simple_crf_frame_refine_pixels(simple_crf_frame_t frame, int H, int W, const uint8_t* image, const uint32_t* assignment, size_t max_iter, float* probas);
+
 /*
  * Inference
  */
@@ -22,6 +22,8 @@ private:
     std::vector<Cluster> clusters;
     std::vector< std::vector<int> > edges;
     std::vector<float> unaries;
+    // Node of the previous frame matched to each node (-1: none). Empty means node i matches node i.
+    std::vector<int> prev_nodes;
 private:
     // States
     std::vector<float> q; // [num_classes, num_nodes]
@@ -38,13 +40,29 @@ public:
     }
     void set_clusters(const Cluster* clusters);
     void set_connectivity(const Connectivity* conn);
+    // Fills clusters, edges and unaries straight from SLIC output (see simple_crf_push_slic_frame)
+    void set_slic(int H, int W, const Cluster* clusters, const uint32_t* assignment, size_t knn, const float* probas, const float* unaries);
+    // Unaries from pixel probabilities float[num_classes, H, W], averaged over the members of each node
+    void pool_probas(int H, int W, const uint32_t* assignment, const float* probas);
 
     const std::vector<int>& connected_nodes(int node) const {
         return edges.at(node);
     }
 
+    void set_temporal_correspondence(const int* prev_nodes) {
+        if (prev_nodes == nullptr) {
+            this->prev_nodes.clear();
+        } else {
+            this->prev_nodes.assign(prev_nodes, prev_nodes + num_nodes);
+        }
+    }
+    int prev_node(int node) const {
+        return prev_nodes.empty() ? node : prev_nodes[node];
+    }
+
     void get_inferred(float *out) const { std::copy(q.begin(), q.end(), out); };
     void reset_inferred();
+    void refine_pixels(int H, int W, const uint8_t* image, const uint32_t* assignment, size_t max_iter, float* probas) const;
 
     void normalize();
     void set_unbiased();
@@ -59,7 +77,10 @@ public:
     void get_unary(float *unaries_out) const {
         std::copy(this->unaries.begin(), this->unaries.end(), unaries_out);
     }
-    float inline calc_temporal_pairwise_energy(int node, const SimpleCRFFrame& other) const;
+    float inline calc_temporal_pairwise_energy(int node, const SimpleCRFFrame& other) const {
+        return calc_temporal_pairwise_energy(node, other, node);
+    }
+    float inline calc_temporal_pairwise_energy(int node, const SimpleCRFFrame& other, int other_node) const;
     float inline calc_spatial_pairwise_energy(int node_i, int node_j) const;
 private:
     friend SimpleCRF;
@@ -85,6 +106,9 @@ public:
         params.spatial_sxy = 80;
         params.spatial_smooth_w = 0;
         params.spatial_smooth_sxy = 3;
+        params.refine_w = 10;
+        params.refine_sxy = 80;
+        params.refine_srgb = 13;
         std::fill_n(compat_by_class.begin(), num_classes, 1.0f);
     };
 
@@ -120,11 +144,20 @@ public:
 
     SimpleCRFFrame& push_frame() {
         simple_crf_time_t next_time = this->next_time++;
-        time_frames.push_back(SimpleCRFFrame(*this, next_time, num_classes, num_nodes));
+        time_frames.emplace_back(*this, next_time, num_classes, num_nodes);
         time_map[next_time] = &time_frames.back();
         return time_frames.back();
     }
 
+    SimpleCRFFrame& push_slic_frame(int H, int W, int K, const Cluster* clusters, const uint32_t* assignment, size_t knn, const float* probas, const float* unaries) {
+        if ((size_t)K != num_nodes) {
+            throw std::invalid_argument("The number of SLIC clusters does not match the number of CRF nodes");
+        }
+        SimpleCRFFrame& frame = push_frame();
+        frame.set_slic(H, W, clusters, assignment, knn, probas, unaries);
+        return frame;
+    }
+
     size_t space_size() const { return num_classes * num_nodes; }
     void initialize();
     void inference(size_t max_iter);
@@ -132,10 +165,10 @@ private:
     void infer_once();
 };
 
-float inline SimpleCRFFrame::calc_temporal_pairwise_energy(int node, const SimpleCRFFrame& other) const {
+float inline SimpleCRFFrame::calc_temporal_pairwise_energy(int node, const SimpleCRFFrame& other, int other_node) const {
     if (this == &other) return 0;
     const Cluster &cluster_1 = clusters[node];
-    const Cluster &cluster_2 = other.clusters[node];
+    const Cluster &cluster_2 = other.clusters[other_node];
     float stdev = parent.params.temporal_srgb;
     float weight = parent.params.temporal_w;
     float exponent = -(
@@ -210,3 +210,140 @@ def test_temporal_energy():
     assert np.isclose(frame_1.temporal_pairwise_energy(0, frame_1), 0)
     assert np.isclose(frame_2.temporal_pairwise_energy(0, frame_2), 0)
 
+
+
+def test_push_slic_frame():
+    from fast_slic import Slic
+    image = np.zeros([60, 80, 3], np.uint8)
+    image[:, 40:] = 200
+    slic = Slic(num_components=16)
+    slic.iterate(image)
+
+    crf = SimpleCRF(2, 16)
+    frame = crf.push_slic_frame(slic)
+    assert (frame.unaries == np.float32(np.log(2))).all()
+    assert frame.get_yxmrgb() == slic.slic_model.to_yxmrgb().tolist()
+    # Edges join exactly the clusters that touch
+    assignment = slic.last_assignment
+    pairs = set(zip(assignment[:, :-1].ravel(), assignment[:, 1:].ravel())) | set(zip(assignment[:-1].ravel(), assignment[1:].ravel()))
+    expected = [set() for _ in range(16)]
+    for a, b in pairs:
+        if a != b:
+            expected[a].add(b)
+            expected[b].add(a)
+    assert [set(nodes) for nodes in frame.get_connectivity()] == expected
+
+    unaries = np.random.rand(2, 16).astype(np.float32)
+    frame = crf.push_slic_frame(slic, unaries=unaries)
+    assert (frame.unaries == unaries).all()
+    assert crf.num_frames == 2
+
+    # Pixel probabilities are averaged over each cluster
+    probas = np.random.rand(2, 60, 80).astype(np.float32)
+    frame = crf.push_slic_frame(slic, probas=probas)
+    pooled = np.array([[probas[cls][assignment == i].mean() for i in range(16)] for cls in range(2)])
+    assert np.allclose(frame.unaries, -np.log(pooled), atol=1e-4)
+
+    frame = crf.push_slic_frame(slic, knn=3)
+    assert all(len(nodes) == 3 and i not in nodes for i, nodes in enumerate(frame.get_connectivity()))
+
+    with pytest.raises(ValueError):
+        SimpleCRF(2, 15).push_slic_frame(slic)
+
+
+def test_refine_pixels():
+    from fast_slic import Slic
+    image = np.zeros([60, 80, 3], np.uint8)
+    image[:, 37:] = 200
+    slic = Slic(num_components=16)
+    assignment = slic.iterate(image)
+
+    crf = SimpleCRF(2, 16)
+    proba = np.zeros([2, 16], np.float32)
+    centers = slic.slic_model.to_yxmrgb()
+    proba[0] = np.where(centers[:, 3] < 100, 0.8, 0.2)
+    proba[1] = 1 - proba[0]
+    frame = crf.push_slic_frame(slic)
+    frame.set_proba(proba)
+    crf.initialize()
+
+    refined = frame.refine_pixels(image, assignment, 5)
+    assert refined.shape == (2, 60, 80)
+    assert np.isclose(refined.sum(axis=0), 1).all()
+    labels = refined.argmax(axis=0)
+    assert (labels[:, :37] == 0).mean() > 0.9
+    assert (labels[:, 37:] == 1).mean() > 0.9
+
+
+def test_refine_pixels_large_coordinates():
+    # Lattice keys outgrow int16 once positions / refine_sxy reach a few thousand
+    from fast_slic import Slic
+    image = np.zeros([8, 4000, 3], np.uint8)
+    image[:, 3000:] = 200
+    slic = Slic(num_components=16)
+    assignment = slic.iterate(image)
+
+    crf = SimpleCRF(2, 16)
+    crf.refine_sxy = 0.5
+    proba = np.zeros([2, 16], np.float32)
+    # Mean colour per label, since thin strips leave some cluster centres stale
+    mean = np.bincount(assignment.ravel(), image[..., 0].ravel(), 16) / np.maximum(np.bincount(assignment.ravel(), minlength=16), 1)
+    proba[0] = np.where(mean < 100, 0.8, 0.2)
+    proba[1] = 1 - proba[0]
+    frame = crf.push_slic_frame(slic)
+    frame.set_proba(proba)
+    crf.initialize()
+
+    labels = frame.refine_pixels(image, assignment, 5).argmax(axis=0)
+    assert (labels[:, :3000] == 0).mean() > 0.9
+    assert (labels[:, 3000:] == 1).mean() > 0.9
+
+
+def test_refine_pixels_frame():
+    # A full 720p frame over the strided lattice; timing lives in the demo main of simple-crf.cpp
+    import os
+    from fast_slic import Slic
+    from PIL import Image
+    with Image.open(os.path.join(os.path.dirname(os.path.abspath(__file__)), "data", "fish.jpg")) as img:
+        image = np.array(img.convert("RGB").resize((1280, 720)))
+    slic = Slic(num_components=1000)
+    assignment = slic.iterate(image)
+
+    crf = SimpleCRF(2, 1000)
+    proba = np.zeros([2, 1000], np.float32)
+    centers = slic.slic_model.to_yxmrgb()
+    proba[0] = np.where(centers[:, 3] < 100, 0.8, 0.2)
+    proba[1] = 1 - proba[0]
+    frame = crf.push_slic_frame(slic)
+    frame.set_proba(proba)
+    crf.initialize()
+
+    refined = frame.refine_pixels(image, assignment, 5)
+    assert refined.shape == (2, 720, 1280)
+    assert np.isfinite(refined).all()
+    assert np.isclose(refined.sum(axis=0), 1).all()
+    # Refinement moves labels near the edges only
+    assert (refined.argmax(axis=0) == proba.argmax(axis=0)[assignment]).mean() > 0.9
+
+
+def test_temporal_correspondence():
+    crf = SimpleCRF(2, 2)
+    frame_1 = crf.push_frame()
+    frame_2 = crf.push_frame()
+    frame_1.set_yxmrgb(np.array([[0, 0, 1, 0, 0, 0], [0, 9, 1, 200, 200, 200]], np.int32))
+    frame_2.set_yxmrgb(np.array([[0, 9, 1, 200, 200, 200], [0, 0, 1, 0, 0, 0]], np.int32))
+    frame_1.set_proba(np.array([[0.9, 0.1], [0.1, 0.9]], np.float32))
+    frame_2.set_unbiased()
+
+    assert frame_2.get_temporal_correspondence() == [0, 1]
+    frame_2.set_temporal_correspondence([1, 0])
+    assert frame_2.get_temporal_correspondence() == [1, 0]
+
+    crf.initialize()
+    crf.inference(3)
+    q = frame_2.get_inferred()
+    assert q[1, 0] > q[0, 0]
+    assert q[0, 1] > q[1, 1]
+
+    frame_2.set_temporal_correspondence(None)
+    assert frame_2.get_temporal_correspondence() == [0, 1]
@@ -72,3 +72,390 @@ def test_slic(fish_image, fish_image_result, fish_image_avx2_result, fish_image_
     assert (SlicAvx2(num_components=256, min_size_factor=0.1).iterate(fish_image) == fish_image_01_avx2_result).all()
 
 
+
+
+def test_associate_clusters():
+    from cfast_slic import ASSOC_SPLIT, ASSOC_MERGE
+    image = np.random.RandomState(0).randint(0, 255, [120, 160, 3]).astype(np.uint8)
+    prev = Slic(num_components=64)
+    prev.iterate(image)
+
+    # Renumber clusters: association should recover the permutation
+    perm = np.random.RandomState(1).permutation(prev.num_components)
+    curr = Slic(num_components=64)
+    curr.slic_model.clusters = [prev.slic_model.clusters[p] for p in perm]
+    correspondence, flags = curr.slic_model.associate_clusters(prev.slic_model, 120, 160)
+    active = np.array([c['num_members'] > 0 for c in curr.slic_model.clusters])
+    assert (correspondence[active] == perm[active]).all()
+    assert (flags[active] & (ASSOC_SPLIT | ASSOC_MERGE) == 0).all()
+
+
+def test_slic_incremental():
+    rs = np.random.RandomState(0)
+    frame_1 = rs.randint(0, 255, [128, 192, 3]).astype(np.uint8)
+    slic = SlicAvx2(num_components=96, incremental=True)
+    assignment_1 = slic.iterate(frame_1)
+    clusters_1 = slic.slic_model.clusters
+
+    # Static frame: nothing is recomputed
+    assert (slic.iterate(frame_1.copy()) == assignment_1).all()
+    assert slic.slic_model.clusters == clusters_1
+
+    # Local change: labels far away from the changed region are reused
+    frame_2 = frame_1.copy()
+    frame_2[96:128, 160:192] = 0
+    assignment_2 = slic.iterate(frame_2)
+    assert (assignment_2[:48, :96] == assignment_1[:48, :96]).all()
+    assert (assignment_2[96:, 160:] != assignment_1[96:, 160:]).any()
+    assert (assignment_2 >= 0).all()
+
+    # Changes below the threshold per frame add up against the frame the labels were computed on
+    frame_3 = frame_2.copy()
+    num_iterations = []
+    for _ in range(4):
+        frame_3[:32, :32] = np.minimum(frame_3[:32, :32].astype(np.int32) + 2, 255)
+        slic.iterate(frame_3)
+        num_iterations.append(slic.num_iterations)
+    assert num_iterations[0] == 0
+    assert max(num_iterations) > 0
+
+    with pytest.raises(ValueError):
+        Slic(num_components=96, incremental=True)
+
+
+def _min_piece_size(assignment):
+    """Size of the smallest 4-connected piece of equal labels."""
+    H, W = assignment.shape
+    seen = np.zeros([H, W], bool)
+    min_size = H * W
+    for y in range(H):
+        for x in range(W):
+            if seen[y, x]:
+                continue
+            seen[y, x] = True
+            stack = [(y, x)]
+            size = 0
+            while stack:
+                i, j = stack.pop()
+                size += 1
+                for ni, nj in ((i - 1, j), (i + 1, j), (i, j - 1), (i, j + 1)):
+                    if 0 <= ni < H and 0 <= nj < W and not seen[ni, nj] and assignment[ni, nj] == assignment[i, j]:
+                        seen[ni, nj] = True
+                        stack.append((ni, nj))
+            min_size = min(min_size, size)
+    return min_size
+
+
+def test_slic_incremental_connectivity():
+    rs = np.random.RandomState(0)
+    frame_1 = rs.randint(0, 255, [128, 192, 3]).astype(np.uint8)
+    slic = SlicAvx2(num_components=96, incremental=True)
+    min_size = 0.05 * 128 * 192 / 96
+    assert _min_piece_size(slic.iterate(frame_1)) >= min_size
+    # The changed rows cut through the superpixels above and below them
+    frame_2 = frame_1.copy()
+    frame_2[40:56] = rs.randint(0, 255, [16, 192, 3])
+    assert _min_piece_size(slic.iterate(frame_2)) >= min_size
+
+
+@pytest.mark.parametrize("slic_class", [Slic, SlicAvx2])
+def test_estimate_motion(slic_class):
+    rs = np.random.RandomState(0)
+    frame = rs.randint(0, 255, [136, 200, 3]).astype(np.uint8)
+    prev_frame = np.ascontiguousarray(frame[4:132, 4:196])
+    curr_frame = np.ascontiguousarray(frame[1:129, 6:198])
+    slic = slic_class(num_components=48)
+    prev_assignment = slic.iterate(prev_frame)
+
+    # The content moved by (+3, -2): every cluster follows it, also those partly pushed out of the image
+    motion = slic.slic_model.estimate_motion(prev_frame, curr_frame, prev_assignment, 4)
+    active = np.array([c['num_members'] > 0 for c in slic.slic_model.clusters])
+    assert (motion[active] == [3, -2]).all()
+    assert (slic.slic_model.estimate_motion(prev_frame, prev_frame, prev_assignment, 4) == 0).all()
+
+
+@pytest.mark.parametrize("slic_class", [Slic, SlicAvx2])
+def test_slic_rejects_non_uint8(slic_class):
+    with pytest.raises(TypeError):
+        slic_class(num_components=16).iterate(np.zeros([32, 32, 3], np.float32))
+
+
+def _mean_color_error(image, assignment):
+    K = assignment.max() + 1
+    counts = np.maximum(np.bincount(assignment.ravel(), minlength=K), 1)
+    error = 0
+    for c in range(3):
+        means = np.bincount(assignment.ravel(), image[..., c].ravel().astype(np.float64), minlength=K) / counts
+        error += np.abs(image[..., c] - means[assignment]).mean()
+    return error / 3
+
+
+@pytest.mark.parametrize("pyramid_levels", [1, 2])
+def test_slic_pyramid(fish_image, pyramid_levels):
+    full = SlicAvx2(num_components=400).iterate(fish_image)
+    coarse_to_fine = SlicAvx2(num_components=400, pyramid_levels=pyramid_levels).iterate(fish_image)
+    assert (coarse_to_fine >= 0).all()
+    assert _mean_color_error(fish_image, coarse_to_fine) < 1.05 * _mean_color_error(fish_image, full)
+    with pytest.raises(ValueError):
+        Slic(num_components=400, pyramid_levels=pyramid_levels)
+
+
+def test_slic_boundary_band(fish_image):
+    full = SlicAvx2(num_components=400).iterate(fish_image)
+    band = SlicAvx2(num_components=400, band_start_iter=3).iterate(fish_image)
+    assert (band >= 0).all()
+    assert _mean_color_error(fish_image, band) < 1.05 * _mean_color_error(fish_image, full)
+    with pytest.raises(ValueError):
+        Slic(num_components=400, band_start_iter=3)
+
+
+def test_slic_distance_bounds(fish_image):
+    full = SlicAvx2(num_components=400).iterate(fish_image)
+    bounded = SlicAvx2(num_components=400, bound_start_iter=2).iterate(fish_image)
+    assert (bounded == full).all()
+    with pytest.raises(ValueError):
+        Slic(num_components=400, bound_start_iter=2)
+
+
+@pytest.mark.parametrize("kwargs", [
+    dict(algorithm='tiled', band_start_iter=3),
+    dict(algorithm='tiled', pyramid_levels=1),
+    dict(algorithm='snic', subsample_iters=2),
+    dict(pyramid_levels=1, bound_start_iter=2),
+    dict(band_start_iter=3, bound_start_iter=2),
+    dict(adaptive_density=True, algorithm='tiled'),
+    dict(adaptive_density=True, pyramid_levels=1),
+    dict(incremental=True, adaptive_density=True),
+    dict(incremental=True, subsample_iters=2),
+    dict(algorithm='tiledd'),
+    dict(algorithm='tiled', extent_margin=8),
+    dict(pyramid_levels=1, extent_margin=8),
+    dict(incremental=True, extent_margin=8),
+    dict(algorithm='compact'),
+])
+def test_slic_rejects_option_combinations(kwargs):
+    with pytest.raises(ValueError):
+        SlicAvx2(num_components=400, **kwargs)
+
+
+def test_slic_rejects_late_option_combinations(fish_image):
+    depth = np.ones(fish_image.shape[:2], dtype=np.float32)
+    with pytest.raises(ValueError):
+        SlicAvx2(num_components=400, algorithm='tiled').iterate(fish_image, depth=depth)
+    # Before the first frame has a reference to be incremental against
+    with pytest.raises(ValueError):
+        SlicAvx2(num_components=400, incremental=True).iterate(fish_image, density=depth)
+    slic_model = SlicAvx2(num_components=400, adaptive_density=True).slic_model
+    slic_model.initialize_adaptive(fish_image, None)
+    with pytest.raises(ValueError):
+        slic_model.iterate(fish_image, 10, 10, 0.05, 6, {'bound_start_iter': 2})
+
+
+def test_slic_subsampled(fish_image):
+    full = SlicAvx2(num_components=400).iterate(fish_image)
+    subsampled = SlicAvx2(num_components=400, subsample_iters=6).iterate(fish_image)
+    assert (subsampled >= 0).all()
+    assert _mean_color_error(fish_image, subsampled) < 1.02 * _mean_color_error(fish_image, full)
+
+
+def test_slic_extent_margin(fish_image):
+    full = SlicAvx2(num_components=400).iterate(fish_image)
+    clipped = SlicAvx2(num_components=400, extent_margin=8).iterate(fish_image)
+    assert ((clipped >= 0) & (clipped < 400)).all()
+    assert _mean_color_error(fish_image, clipped) < 1.02 * _mean_color_error(fish_image, full)
+    with pytest.raises(ValueError):
+        Slic(num_components=400, extent_margin=8)
+
+
+def test_slic_tiled(fish_image):
+    cluster_oriented = SlicAvx2(num_components=400).iterate(fish_image)
+    tiled = SlicAvx2(num_components=400, algorithm='tiled').iterate(fish_image)
+    assert (tiled == cluster_oriented).all()
+
+
+@pytest.mark.parametrize("slic_class", [Slic, SlicAvx2])
+def test_slic_spatial_patch_reuse(fish_image, slic_class):
+    # Interleaved parameters must not pick up each other's cached spatial patches
+    first = slic_class(num_components=400, compactness=10).iterate(fish_image)
+    slic_class(num_components=400, compactness=30).iterate(fish_image)
+    slic_class(num_components=100, compactness=10).iterate(fish_image)
+    again = slic_class(num_components=400, compactness=10).iterate(fish_image)
+    assert (first == again).all()
+
+
+def _count_components(assignment):
+    # Union-find over 4-connected pixels sharing a label
+    H, W = assignment.shape
+    labels = assignment.ravel()
+    parent = np.arange(H * W)
+
+    def find(x):
+        while parent[x] != x:
+            parent[x] = parent[parent[x]]
+            x = parent[x]
+        return x
+
+    index = np.arange(H * W).reshape(H, W)
+    pairs = [(index[:, :-1], index[:, 1:]), (index[:-1, :], index[1:, :])]
+    for a, b in pairs:
+        a, b = a.ravel(), b.ravel()
+        same = labels[a] == labels[b]
+        for x, y in zip(a[same], b[same]):
+            rx, ry = find(x), find(y)
+            if rx != ry:
+                parent[rx] = ry
+    return len({find(x) for x in range(H * W)})
+
+
+@pytest.mark.parametrize("slic_class", [Slic, SlicAvx2])
+def test_slic_snic(fish_image, slic_class):
+    full = slic_class(num_components=400).iterate(fish_image)
+    snic = slic_class(num_components=400, algorithm='snic').iterate(fish_image)
+    assert ((snic >= 0) & (snic < 400)).all()
+    assert _mean_color_error(fish_image, snic) < 1.15 * _mean_color_error(fish_image, full)
+
+    small = np.ascontiguousarray(fish_image[::8, ::8])
+    small_snic = slic_class(num_components=100, algorithm='snic').iterate(small)
+    assert _count_components(small_snic) == len(np.unique(small_snic))
+
+
+def test_slic_seeds(fish_image):
+    full = SlicAvx2(num_components=400).iterate(fish_image)
+    seeds = SlicAvx2(num_components=400, algorithm='seeds').iterate(fish_image)
+    assert ((seeds >= 0) & (seeds < 400)).all()
+    assert _mean_color_error(fish_image, seeds) < 1.15 * _mean_color_error(fish_image, full)
+
+    small = np.ascontiguousarray(fish_image[::8, ::8])
+    small_seeds = SlicAvx2(num_components=100, algorithm='seeds').iterate(small)
+    assert _count_components(small_seeds) == len(np.unique(small_seeds))
+
+
+@pytest.mark.parametrize("slic_class", [Slic, SlicAvx2])
+def test_slic_adaptive_density(fish_image, slic_class):
+    # Fewer adaptive superpixels do as well as more regular ones
+    regular = slic_class(num_components=400).iterate(fish_image)
+    slic = slic_class(num_components=360, adaptive_density=True)
+    adaptive = slic.iterate(fish_image)
+    assert ((adaptive >= 0) & (adaptive < 360)).all()
+    assert slic.slic_model.cluster_S.min() < slic.slic_model.cluster_S.max()
+    assert _mean_color_error(fish_image, adaptive) < 1.01 * _mean_color_error(fish_image, regular)
+
+    # A wide frame gets a wide grid of square cells, not sqrt(K) rows of flat ones
+    wide = np.ascontiguousarray(np.tile(fish_image[:256], (1, 2, 1)))
+    slic = slic_class(num_components=256, adaptive_density=True)
+    slic.slic_model.initialize_adaptive(wide, None)
+    S = np.sqrt(wide.shape[0] * wide.shape[1] / 256)
+    assert len(np.unique(slic.slic_model.to_yxmrgb()[:, 0])) < 8
+    assert np.median(slic.slic_model.cluster_S) < 1.5 * S
+
+    # A user map puts the seeds where it is high
+    H, W = fish_image.shape[:2]
+    density = np.ones([H, W], dtype=np.float32)
+    density[:H // 2] = 4
+    slic = slic_class(num_components=100)
+    slic.iterate(fish_image, density=density)
+    ys = slic.slic_model.to_yxmrgb()[:, 0]
+    assert (ys < H // 2).sum() > 2 * (ys >= H // 2).sum()
+
+
+def test_slic_hierarchy(fish_image):
+    slic = Slic(num_components=400)
+    assignment = slic.iterate(fish_image)
+    merges, distances = slic.slic_model.build_hierarchy(fish_image, assignment)
+    assert merges.shape == (399, 2)
+    # Every node is merged at most once, into a node created later
+    assert len(np.unique(merges)) == merges.size
+    assert (merges < 400 + np.arange(399)[:, None]).all()
+
+    coarse = slic.slic_model.cut_hierarchy(merges, assignment, 50)
+    assert len(np.unique(coarse)) == 50
+    assert coarse.max() == 49
+    # Superpixels stay whole in the coarse regions
+    for label in np.unique(assignment)[:20]:
+        assert len(np.unique(coarse[assignment == label])) == 1
+    assert len(np.unique(slic.slic_model.cut_hierarchy(merges, assignment, 400))) == 400
+    assert len(np.unique(slic.slic_model.cut_hierarchy(merges, assignment, 1))) == 1
+    unassigned = assignment.copy()
+    unassigned[:10, :10] = -1
+    cut = slic.slic_model.cut_hierarchy(merges, unassigned, 1)
+    assert (cut[:10, :10] == -1).all()
+    assert (cut[unassigned >= 0] == cut[10, 10]).all()
+
+
+def test_slic_volume():
+    # A bright ball in a dark noisy volume
+    z, y, x = np.mgrid[:32, :64, :64]
+    inside = (z - 16) ** 2 + (y - 32) ** 2 + (x - 32) ** 2 < 15 ** 2
+    rng = np.random.RandomState(0)
+    volume = np.where(inside[..., None], 200, 50) + rng.randint(0, 10, size=inside.shape + (3,))
+    volume = volume.astype(np.uint8)
+
+    labels = SlicAvx2(num_components=128, compactness=10).iterate_volume(volume)
+    assert labels.shape == inside.shape
+    assert ((labels >= 0) & (labels < 128)).all()
+    # Supervoxels do not straddle the ball and span several slices
+    in_counts = np.bincount(labels[inside], minlength=128)
+    out_counts = np.bincount(labels[~inside], minlength=128)
+    assert np.minimum(in_counts, out_counts).sum() < 0.01 * labels.size
+    slices_per_label = [len(np.unique(np.nonzero(labels == k)[0])) for k in np.unique(labels)]
+    assert np.median(slices_per_label) >= 4
+
+
+def test_slic_depth():
+    # Same colors on both sides of a diagonal depth edge: only the depth tells them apart
+    rng = np.random.RandomState(0)
+    image = rng.randint(100, 110, size=(120, 160, 3)).astype(np.uint8)
+    y, x = np.mgrid[:120, :160]
+    near = x > y + 20
+    depth = np.where(near, 500, 3000).astype(np.uint16)
+
+    def straddling(assignment):
+        near_counts = np.bincount(assignment[near], minlength=assignment.max() + 1)
+        far_counts = np.bincount(assignment[~near], minlength=assignment.max() + 1)
+        return np.minimum(near_counts, far_counts).sum()
+
+    plain = SlicAvx2(num_components=100).iterate(image)
+    rgbd = SlicAvx2(num_components=100, depth_weight=0.05).iterate(image, depth=depth)
+    assert ((rgbd >= 0) & (rgbd < 100)).all()
+    assert straddling(rgbd) < 0.2 * straddling(plain)
+    with pytest.raises(NotImplementedError):
+        Slic(num_components=100).iterate(image, depth=depth)
+
+
+def test_slic_auto_quantize_level(fish_image):
+    from cfast_slic import auto_quantize_level
+    # Full-range channels and compactness 10: (765 + 255) << 6 fits in 16 bits, << 7 does not
+    full = np.zeros([2, 2, 3], dtype=np.uint8)
+    full[0, 0] = 255
+    assert auto_quantize_level(full, 10) == 6
+    assert auto_quantize_level(np.zeros([2, 2, 3], dtype=np.uint8), 10) == 8
+
+    # The spatial term alone nearly fills 16 bits at the window corners
+    saturating = SlicAvx2(num_components=400, compactness=40, quantize_level=6, count_saturation=True)
+    saturating.iterate(fish_image)
+    assert saturating.num_saturated > 0
+    slic = SlicAvx2(num_components=400, compactness=40, quantize_level='auto', count_saturation=True)
+    assignment = slic.iterate(fish_image)
+    assert slic.num_saturated == 0
+    assert ((assignment >= 0) & (assignment < 400)).all()
+    assert SlicAvx2(num_components=400).num_saturated is None
+    # Nor do the kernels that cannot count
+    for slic in [Slic(num_components=400, count_saturation=True),
+                 SlicAvx2(num_components=400, algorithm='tiled', count_saturation=True),
+                 SlicAvx2(num_components=400, band_start_iter=3, count_saturation=True)]:
+        slic.iterate(fish_image)
+        assert slic.num_saturated is None
+
+
+@pytest.mark.parametrize("slic_class", [Slic, SlicAvx2])
+def test_slic_time_budget(fish_image, slic_class):
+    slic = slic_class(num_components=400, compactness=10)
+    slic.iterate(fish_image, max_iter=5)
+    assert slic.num_iterations == 5
+
+    # An exhausted budget stops the iterations early, after at least the first one; the timing itself is in the
+    # benchmark main of fast-slic-avx2.cpp
+    slic = slic_class(num_components=400, compactness=10, time_budget_ms=0.01)
+    assignment = slic.iterate(fish_image, max_iter=5)
+    assert 1 <= slic.num_iterations < 5
+    assert ((assignment >= 0) & (assignment < 400)).all()